@@ -1,15 +1,30 @@
 import os
+import sys
 import logging
 import json
+import base64
+import asyncio
+import re
+import time
+import hashlib
 import psycopg2
-from fastapi import FastAPI, HTTPException, Query
-from pydantic import BaseModel
-from typing import List
+import yaml
+import numpy as np
+from fastapi import FastAPI, HTTPException, Query, Request, Header
+from fastapi.responses import StreamingResponse, Response
+from pydantic import BaseModel, ValidationError
+from typing import List, Optional
 import threading
 import redis
+import redis.asyncio
+import asyncpg
 from databases import Database
 import paho.mqtt.client as mqtt
-from datetime import datetime
+from datetime import datetime, timezone, timedelta
+from collections import defaultdict, deque
+
+sys.path.append(os.path.dirname(os.path.abspath(__file__)))  # Moduli condivisi con i mock
+import frame_auth
 
 # ========== Parametri ==========
 DB_URL = os.getenv("DB_URL")                         # Connessione al DB
@@ -18,16 +33,37 @@ DB_PASSWORD = os.getenv("DB_PASSWORD")               # Password utente cliente
 DB_NAME = os.getenv("DB_NAME")                       # Nome del database
 SUPERUSER_NAME = os.getenv("SUPERUSER_NAME")         # Superuser di PostgreSQL
 SUPERUSER_PASSWORD = os.getenv("SUPERUSER_PASSWORD") # Password del superuser
-USE_MQTT = os.getenv("USE_MQTT")                     # Se abilitare MQTT
+USE_MQTT = os.getenv("USE_MQTT", "0").lower() in ("1", "true", "yes")  # Se abilitare MQTT
 MQTT_BROKER = os.getenv("MQTT_BROKER")               # MQTT Broker address
 MQTT_PORT = int(os.getenv("MQTT_PORT"))              # MQTT Broker port
 MQTT_TOPIC = os.getenv("MQTT_TOPIC")                 # MQTT topic
+MQTT_QOS = int(os.getenv("MQTT_QOS", "1"))           # QoS della sottoscrizione
+MQTT_CLIENT_ID = os.getenv("MQTT_CLIENT_ID", "vitimonitor-backend")  # ID fisso: sessione persistente sul broker
+MQTT_QUEUE_SIZE = int(os.getenv("MQTT_QUEUE_SIZE", "10000"))  # Letture MQTT in coda al massimo
+MQTT_BATCH_SIZE = int(os.getenv("MQTT_BATCH_SIZE", "500"))    # Letture per scrittura nel database
+MQTT_FLUSH_MS = int(os.getenv("MQTT_FLUSH_MS", "200"))        # Attesa massima prima di scrivere un batch
+BULK_MAX_READINGS = int(os.getenv("BULK_MAX_READINGS", "10000"))    # Letture massime per richiesta bulk
+INGEST_KEY_TTL_DAYS = int(os.getenv("INGEST_KEY_TTL_DAYS", "7"))    # Durata delle chiavi di idempotenza
+READING_MAX_SKEW_S = int(os.getenv("READING_MAX_SKEW_S", "300"))    # Anticipo massimo del timestamp di una lettura firmata
+DATA_PAGE_SIZE = int(os.getenv("DATA_PAGE_SIZE", "1000"))           # Righe per pagina di /data (default)
+DATA_PAGE_MAX = int(os.getenv("DATA_PAGE_MAX", "10000"))            # Righe massime per pagina di /data
+PARTITION_MONTHS_AHEAD = int(os.getenv("PARTITION_MONTHS_AHEAD", "2"))  # Partizioni mensili create in anticipo
+AGGREGATE_MAX_BUCKETS = int(os.getenv("AGGREGATE_MAX_BUCKETS", "10000"))  # Bucket massimi per /data/aggregate
+REDIS_HOST = os.getenv("REDIS_HOST", "localhost")    # Redis per la cache
+REDIS_PORT = int(os.getenv("REDIS_PORT", "6379"))    # Porta di Redis
+QUERY_CACHE_TTL = int(os.getenv("QUERY_CACHE_TTL", "300"))          # Durata dei risultati in cache (s)
+QUERY_CACHE_MAX_DAYS = int(os.getenv("QUERY_CACHE_MAX_DAYS", "366"))  # Intervalli più lunghi non vanno in cache
+ZONE_WINDOW_MINUTES = int(os.getenv("ZONE_WINDOW_MINUTES", "60"))   # Finestra mobile delle statistiche per zona
+CHANGES_STREAM_MAXLEN = int(os.getenv("CHANGES_STREAM_MAXLEN", "10000"))  # Voci conservate nello stream delle modifiche
+SSE_KEEPALIVE_S = int(os.getenv("SSE_KEEPALIVE_S", "15"))           # Intervallo dei keepalive di /stream
+SSE_REPLAY_MAX = int(os.getenv("SSE_REPLAY_MAX", "1000"))           # Voci recuperate alla riconnessione di /stream
+CONFIG_FILE = os.getenv("CONFIG_FILE", os.path.join(os.path.dirname(__file__), "..", "config.yml"))  # Soglie e regole delle anomalie
 
 # ========== Connessione al database PostgreSQL ==========
 database = Database(DB_URL)  # Connessione al database asincrono
 
 # ========== Connessione a Redis per caching ==========
-redis_client = redis.StrictRedis(host='localhost', port=6379, db=0)  # Connessione a Redis
+redis_client = redis.asyncio.Redis(host=REDIS_HOST, port=REDIS_PORT, db=0, decode_responses=True)  # Connessione a Redis
 
 # ========== Creazione dell'istanza FastAPI ==========
 app = FastAPI()  # Istanza dell'app FastAPI
@@ -39,10 +75,12 @@ class SensorData(BaseModel):
     zone: str  # Zona del sensore
     temperature: float  # Temperatura rilevata
     humidity_air: float  # Umidità dell'aria
-    humidity_soil: float  # Umidità del suolo
+    humidity_soil: Optional[float] = None  # Umidità del suolo (None: nodo senza sonda)
     luminosity: float  # Luminosità
     signature: str  # Firma del dato
     manual: bool = False  # Indica se la misura è manuale (default False)
+    timestamp: Optional[datetime] = None  # Istante della misura (default: ricezione)
+    idempotency_key: Optional[str] = None  # Chiave per scartare i reinvii (derivata dalla firma, non dal client)
 
 # ========== Connessione al database ==========
 # Funzione che viene eseguita all'avvio dell'app
@@ -54,34 +92,279 @@ async def startup():
     # Connette al database e crea le tabelle necessarie
     await database.connect()
     await create_tables()
+    await create_future_partitions()  # Prima dell'ingest: nessuna lettura recente nella DEFAULT
+    await prune_ingest_keys()
+    asyncio.create_task(maintain_tables())
+    await warm_latest_cache()  # Ultime letture per /state
+    await warm_anomaly_detector()  # Statistiche per sensore per lo z-score
+    asyncio.create_task(broadcaster.run())  # Modifiche in push per /stream
 
 # Funzione che viene eseguita alla chiusura dell'app
 @app.on_event("shutdown")
 async def shutdown():
     await database.disconnect()  # Disconnette la connessione al database
+    await redis_client.aclose()  # Chiude le connessioni a Redis
+
+# ========== Partizioni e rollup ==========
+METRICHE = ['temperature', 'humidity_air', 'humidity_soil', 'luminosity']
+
+# Risoluzioni dei rollup: nome -> (intervallo SQL, secondi)
+ROLLUPS = {
+    '5m': ('5 minutes', 300),
+    '1h': ('1 hour', 3600),
+    '1d': ('1 day', 86400),
+}
+
+# Origine comune dei bucket (UTC): i bucket di tutte le risoluzioni sono allineati
+BUCKET_ORIGIN = "TIMESTAMPTZ '2000-01-01 00:00:00+00'"
+
+# sensor_data partizionata per mese; la chiave primaria deve includere la chiave di partizione
+SENSOR_DATA_DDL = '''
+CREATE TABLE IF NOT EXISTS sensor_data (
+    id BIGSERIAL,
+    sensor_id TEXT,
+    zone TEXT,
+    temperature REAL,
+    humidity_air REAL,
+    humidity_soil REAL,
+    luminosity REAL,
+    signature TEXT,
+    manual BOOLEAN DEFAULT FALSE,
+    timestamp TIMESTAMPTZ NOT NULL DEFAULT CURRENT_TIMESTAMP,
+    PRIMARY KEY (id, timestamp)
+) PARTITION BY RANGE (timestamp);
+'''
+
+# Rollup per sensore e bucket: conteggi, somme, quadrati, minimo e massimo permettono di
+# ricomporre media e deviazione standard su qualunque bucket più grosso. Il conteggio è per
+# metrica perché una lettura può non averle tutte (nodi LoRa senza sonda del suolo)
+def rollup_ddl(resolution):
+    metrics = ",\n".join(f"    {m}_n BIGINT, {m}_sum DOUBLE PRECISION, {m}_sq DOUBLE PRECISION, {m}_min REAL, {m}_max REAL"
+                          for m in METRICHE)
+    return f'''
+CREATE TABLE IF NOT EXISTS sensor_rollup_{resolution} (
+    bucket TIMESTAMPTZ NOT NULL,
+    sensor_id TEXT NOT NULL,
+    zone TEXT,
+    n BIGINT NOT NULL,
+{metrics},
+    PRIMARY KEY (sensor_id, bucket)
+);
+'''
+
+# Somma nei rollup le righe di source (tabella o CTE con le colonne di sensor_data)
+def rollup_upsert_sql(resolution, source):
+    interval = ROLLUPS[resolution][0]
+    columns = ", ".join(f"{m}_n, {m}_sum, {m}_sq, {m}_min, {m}_max" for m in METRICHE)
+    aggregates = ", ".join(f"count({m}), COALESCE(sum({m}::float8), 0), COALESCE(sum({m}::float8 * {m}), 0), min({m}), max({m})"
+                           for m in METRICHE)
+    # I bucket scritti prima dei conteggi per metrica hanno {m}_n NULL: valeva n
+    updates = ", ".join(f"{m}_n = COALESCE(r.{m}_n, r.n) + EXCLUDED.{m}_n, "
+                        f"{m}_sum = r.{m}_sum + EXCLUDED.{m}_sum, {m}_sq = r.{m}_sq + EXCLUDED.{m}_sq, "
+                        f"{m}_min = LEAST(r.{m}_min, EXCLUDED.{m}_min), {m}_max = GREATEST(r.{m}_max, EXCLUDED.{m}_max)"
+                        for m in METRICHE)
+    # ORDER BY: ingest concorrenti bloccano le righe dei rollup sempre nello stesso ordine
+    return f'''
+    INSERT INTO sensor_rollup_{resolution} AS r (bucket, sensor_id, zone, n, {columns})
+    SELECT date_bin('{interval}', timestamp, {BUCKET_ORIGIN}), sensor_id, max(zone), count(*), {aggregates}
+    FROM {source}
+    WHERE sensor_id IS NOT NULL
+    GROUP BY 1, 2
+    ORDER BY 2, 1
+    ON CONFLICT (sensor_id, bucket) DO UPDATE SET n = r.n + EXCLUDED.n, zone = EXCLUDED.zone, {updates}
+    '''
+
+# Inserimento in sensor_data e aggiornamento dei rollup in un'unica istruzione;
+# restituisce le righe inserite (per la cache e il flusso delle modifiche)
+def ingest_sql(insert, ctes=()):
+    returning = f"RETURNING id, sensor_id, zone, {', '.join(METRICHE)}, signature, manual, timestamp"
+    ctes = list(ctes) + [f"inserted AS ({insert} {returning})"]
+    ctes += [f"rollup_{res} AS ({rollup_upsert_sql(res, 'inserted')})" for res in ROLLUPS]
+    return "WITH " + ",\n".join(ctes) + "\nSELECT * FROM inserted"
+
+def month_start(moment):
+    return datetime(moment.year, moment.month, 1, tzinfo=timezone.utc)
+
+def next_month(moment):
+    return datetime(moment.year + moment.month // 12, moment.month % 12 + 1, 1, tzinfo=timezone.utc)
+
+# Primo mese senza partizione creata in anticipo: le letture da lì in poi finirebbero nella DEFAULT
+def partition_horizon(now=None):
+    month = month_start(now or datetime.now(timezone.utc))
+    for _ in range(PARTITION_MONTHS_AHEAD + 1):
+        month = next_month(month)
+    return month
+
+def as_utc(moment):
+    return moment if moment.tzinfo else moment.replace(tzinfo=timezone.utc)
+
+partition_months = set()  # Mesi con una partizione già verificata da questo processo
+
+# Crea la partizione di un mese. Le righe finite nella DEFAULT per quel mese impedirebbero
+# CREATE TABLE ... PARTITION OF: si crea la tabella a parte, ci si spostano le righe e la si aggancia
+async def create_partition(month):
+    name = f"sensor_data_{month:%Y_%m}"
+    async with database.transaction():
+        # Più processi del backend non creano la stessa partizione in contemporanea
+        await database.execute("SELECT pg_advisory_xact_lock(hashtext('sensor_data_partitions'))")
+        if not await database.fetch_val("SELECT to_regclass(:name) IS NOT NULL", {'name': name}):
+            await database.execute(f"CREATE TABLE {name} (LIKE sensor_data INCLUDING DEFAULTS INCLUDING CONSTRAINTS)")
+            moved = await database.fetch_val(f'''
+            WITH moved AS (
+                DELETE FROM sensor_data_default WHERE timestamp >= :start AND timestamp < :end RETURNING *
+            ), copied AS (INSERT INTO {name} SELECT * FROM moved RETURNING 1)
+            SELECT count(*) FROM copied
+            ''', {'start': month, 'end': next_month(month)})
+            await database.execute(
+                f"ALTER TABLE sensor_data ATTACH PARTITION {name} "
+                f"FOR VALUES FROM ('{month.isoformat()}') TO ('{next_month(month).isoformat()}')")
+            if moved:
+                logging.warning(f"Partizione {month:%Y_%m}: {moved} righe spostate dalla DEFAULT")
+    partition_months.add(month)
+
+# Crea le partizioni mensili da first a last (inclusi)
+async def create_partitions(first, last):
+    month = month_start(first)
+    while month <= last:
+        await create_partition(month)
+        month = next_month(month)
+
+# Partizioni dei mesi di un batch non ancora verificate, prima della transazione di ingest:
+# anche un recupero di letture vecchie finisce nella sua partizione e non nella DEFAULT
+async def ensure_partitions(timestamps):
+    for month in sorted({month_start(as_utc(t)) for t in timestamps} - partition_months):
+        try:
+            await create_partition(month)
+        except Exception as e:
+            logging.warning(f"Partizione {month:%Y_%m} non creata: {e}")  # Le righe restano nella DEFAULT
+
+# Partizioni del mese corrente e dei prossimi PARTITION_MONTHS_AHEAD
+async def create_future_partitions():
+    now = datetime.now(timezone.utc)
+    month = month_start(now)
+    while month < partition_horizon(now):
+        try:
+            await create_partition(month)
+        except Exception as e:
+            logging.warning(f"Partizione {month:%Y_%m} non creata: {e}")
+        month = next_month(month)
+
+# Elimina le chiavi di idempotenza scadute a blocchi, per non tenere a lungo i lock
+# (con l'MQTT ogni lettura aggiunge una chiave: milioni di righe al giorno)
+async def prune_ingest_keys(chunk=50000):
+    while True:
+        deleted = await database.fetch_val('''
+        WITH expired AS (
+            SELECT key FROM ingest_keys WHERE created_at < CURRENT_TIMESTAMP - make_interval(days => :days) LIMIT :chunk
+        ), deleted AS (DELETE FROM ingest_keys WHERE key IN (SELECT key FROM expired) RETURNING 1)
+        SELECT count(*) FROM deleted
+        ''', {'days': INGEST_KEY_TTL_DAYS, 'chunk': chunk})
+        if deleted < chunk:
+            return
+
+# Manutenzione ogni ora (la prima passata è nello startup): partizioni future e chiavi scadute
+async def maintain_tables():
+    while True:
+        await asyncio.sleep(3600)
+        await create_future_partitions()
+        try:
+            await prune_ingest_keys()
+        except Exception as e:
+            logging.warning(f"Chiavi di idempotenza non eliminate: {e}")
+
+# Migrazione da sensor_data non partizionata (versioni precedenti): rinomina la tabella
+# per copiarne le righe nella nuova; True se c'è da copiare
+async def detach_legacy_table():
+    kind = await database.fetch_val('''
+    SELECT c.relkind FROM pg_class c JOIN pg_namespace n ON n.oid = c.relnamespace
+    WHERE c.relname = 'sensor_data' AND n.nspname = current_schema()
+    ''')
+    if kind != 'r':
+        return False
+    logging.warning("Migrazione di sensor_data in tabella partizionata per mese")
+    await database.execute('ALTER TABLE sensor_data RENAME TO sensor_data_legacy')
+    # Gli indici seguono la tabella: liberano i nomi per quelli della nuova
+    for index in ('idx_sensor_id', 'idx_timestamp', 'idx_zone', 'idx_timestamp_id'):
+        await database.execute(f'ALTER INDEX IF EXISTS {index} RENAME TO {index}_legacy')
+    return True
+
+# Copia le righe della vecchia tabella, riallinea la sequenza degli id e ricostruisce i rollup
+async def migrate_legacy_rows():
+    now = datetime.now(timezone.utc)
+    first = await database.fetch_val('SELECT min(timestamp) FROM sensor_data_legacy')
+    await create_partitions(first or now, now)
+    await database.execute('''
+    INSERT INTO sensor_data (id, sensor_id, zone, temperature, humidity_air, humidity_soil, luminosity, signature, manual, timestamp)
+    SELECT id, sensor_id, zone, temperature, humidity_air, humidity_soil, luminosity, signature, manual,
+           COALESCE(timestamp, CURRENT_TIMESTAMP)
+    FROM sensor_data_legacy
+    ''')
+    await database.execute(
+        "SELECT setval(pg_get_serial_sequence('sensor_data', 'id'), COALESCE((SELECT max(id) FROM sensor_data), 0) + 1, false)")
+    await database.execute('DROP TABLE sensor_data_legacy')
+    for resolution in ROLLUPS:
+        await database.execute(rollup_upsert_sql(resolution, 'sensor_data'))
 
 # ========== Funzioni per creare tabelle e indici nel database ==========
 # Funzione per creare le tabelle nel database
 async def create_tables():
-    query = '''
-    CREATE TABLE IF NOT EXISTS sensor_data (
-        id SERIAL PRIMARY KEY,
-        sensor_id TEXT,
-        zone TEXT,
-        temperature REAL,
-        humidity_air REAL,
-        humidity_soil REAL,
-        luminosity REAL,
-        signature TEXT,
-        manual BOOLEAN DEFAULT FALSE,
-        timestamp TIMESTAMPTZ DEFAULT CURRENT_TIMESTAMP
-    );
-    '''
-    async with database.transaction():  # Usa una transazione asincrona per eseguire la query
-        await database.execute(query)  # Esegui la query per creare la tabella
+    async with database.transaction():  # Usa una transazione asincrona: la migrazione è tutta o niente
+        migrate = await detach_legacy_table()
+        await database.execute(SENSOR_DATA_DDL)  # Esegui la query per creare la tabella
+        await database.execute('CREATE TABLE IF NOT EXISTS sensor_data_default PARTITION OF sensor_data DEFAULT;')  # Righe fuori dai mesi creati
+
+        for resolution in ROLLUPS:
+            await database.execute(rollup_ddl(resolution))
+            await database.execute(f"ALTER TABLE sensor_rollup_{resolution} " +
+                                   ", ".join(f"ADD COLUMN IF NOT EXISTS {m}_n BIGINT" for m in METRICHE))
+            await database.execute(f'CREATE INDEX IF NOT EXISTS idx_rollup_{resolution}_bucket ON sensor_rollup_{resolution}(bucket);')
+            await database.execute(f'CREATE INDEX IF NOT EXISTS idx_rollup_{resolution}_zone ON sensor_rollup_{resolution}(zone, bucket);')
+
+        if migrate:
+            await migrate_legacy_rows()
+
         await database.execute('CREATE INDEX IF NOT EXISTS idx_sensor_id ON sensor_data(sensor_id);')  # Indice per sensor_id
-        await database.execute('CREATE INDEX IF NOT EXISTS idx_timestamp ON sensor_data(timestamp);')  # Indice per timestamp
+        await database.execute('CREATE INDEX IF NOT EXISTS idx_timestamp_brin ON sensor_data USING BRIN (timestamp);')  # Intervalli di tempo
         await database.execute('CREATE INDEX IF NOT EXISTS idx_zone ON sensor_data(zone);')  # Indice per zona
+        await database.execute('CREATE INDEX IF NOT EXISTS idx_timestamp_id ON sensor_data(timestamp DESC, id DESC);')  # Paginazione a cursore
+
+        # Chiavi di idempotenza già viste: un reinvio dello stesso batch non duplica le letture
+        await database.execute('''
+        CREATE TABLE IF NOT EXISTS ingest_keys (
+            key TEXT PRIMARY KEY,
+            created_at TIMESTAMPTZ DEFAULT CURRENT_TIMESTAMP
+        );
+        ''')
+        await database.execute('CREATE INDEX IF NOT EXISTS idx_ingest_keys_created ON ingest_keys(created_at);')
+
+        # Ultimo contatore accettato per nodo LoRa: le trame con un contatore già visto sono replay
+        await database.execute('''
+        CREATE TABLE IF NOT EXISTS frame_counters (
+            device_id BIGINT PRIMARY KEY,
+            counter BIGINT NOT NULL,
+            updated_at TIMESTAMPTZ DEFAULT CURRENT_TIMESTAMP
+        );
+        ''')
+
+        # Anomalie rilevate durante l'ingest (una riga per lettura, metrica e regola)
+        await database.execute('''
+        CREATE TABLE IF NOT EXISTS anomalies (
+            id BIGSERIAL PRIMARY KEY,
+            reading_id BIGINT,
+            sensor_id TEXT,
+            zone TEXT,
+            metric TEXT,
+            rule TEXT,
+            value REAL,
+            threshold REAL,
+            score REAL,
+            timestamp TIMESTAMPTZ NOT NULL,
+            detected_at TIMESTAMPTZ DEFAULT CURRENT_TIMESTAMP
+        );
+        ''')
+        await database.execute('CREATE INDEX IF NOT EXISTS idx_anomalies_timestamp ON anomalies(timestamp DESC);')
+        await database.execute('CREATE INDEX IF NOT EXISTS idx_anomalies_sensor ON anomalies(sensor_id, timestamp DESC);')
+        await database.execute('CREATE INDEX IF NOT EXISTS idx_anomalies_zone ON anomalies(zone, timestamp DESC);')
 
 # ========== Funzione per configurare il database e l'utente ==========
 # Funzione per configurare il database e l'utente se non esistono
@@ -124,13 +407,30 @@ async def configure_database():
 
 # ========== Funzione per salvare i dati nel DB ==========
 # Funzione che salva i dati ricevuti nel database
-async def save_to_db(sensor_data: SensorData):
-    query = '''
-    INSERT INTO sensor_data (sensor_id, zone, temperature, humidity_air, humidity_soil, luminosity, signature, manual)
-    VALUES (:sensor_id, :zone, :temperature, :humidity_air, :humidity_soil, :luminosity, :signature, :manual)
-    '''
-    # Esegui l'inserimento dei dati nel database
-    await database.execute(query, {
+INSERT_ONE = ingest_sql('''
+    INSERT INTO sensor_data (sensor_id, zone, temperature, humidity_air, humidity_soil, luminosity, signature, manual, timestamp)
+    VALUES (:sensor_id, :zone, :temperature, :humidity_air, :humidity_soil, :luminosity, :signature, :manual,
+            COALESCE(:timestamp, CURRENT_TIMESTAMP))
+''')
+
+# Con la chiave di idempotenza la lettura entra solo se la chiave è nuova: un reinvio non inserisce righe
+INSERT_ONE_KEYED = ingest_sql('''
+    INSERT INTO sensor_data (sensor_id, zone, temperature, humidity_air, humidity_soil, luminosity, signature, manual, timestamp)
+    SELECT :sensor_id, :zone, :temperature, :humidity_air, :humidity_soil, :luminosity, :signature, :manual,
+           COALESCE(:timestamp, CURRENT_TIMESTAMP)
+    FROM new_key
+''', ctes=['''new_key AS (
+    INSERT INTO ingest_keys (key) VALUES (:idempotency_key)
+    ON CONFLICT DO NOTHING
+    RETURNING key
+)'''])
+
+# Salva una lettura; False se la sua chiave di idempotenza era già stata vista (reinvio)
+async def save_to_db(sensor_data: SensorData) -> bool:
+    # Istante della misura come per /data/bulk e MQTT (default: ricezione), nella sua partizione
+    timestamp = as_utc(sensor_data.timestamp) if sensor_data.timestamp else None
+    await ensure_partitions([timestamp or datetime.now(timezone.utc)])
+    values = {
         'sensor_id': sensor_data.sensor_id,
         'zone': sensor_data.zone,
         'temperature': sensor_data.temperature,
@@ -138,35 +438,840 @@ async def save_to_db(sensor_data: SensorData):
         'humidity_soil': sensor_data.humidity_soil,
         'luminosity': sensor_data.luminosity,
         'signature': sensor_data.signature,
-        'manual': sensor_data.manual
-    })
+        'manual': sensor_data.manual,
+        'timestamp': timestamp
+    }
+    # Esegui l'inserimento dei dati nel database (e nei rollup), poi aggiorna cache e flusso delle modifiche
+    if sensor_data.idempotency_key is None:
+        row = await database.fetch_one(INSERT_ONE, values)
+    else:
+        row = await database.fetch_one(INSERT_ONE_KEYED, {**values, 'idempotency_key': sensor_data.idempotency_key})
+    if row is None:
+        return False
+    await after_ingest([dict(row)])
+    return True
+
+# ========== Funzioni per l'ingest a batch ==========
+# Colonne della tabella di appoggio, nell'ordine dei record passati a COPY
+STAGING_COLUMNS = ['sensor_id', 'zone', 'temperature', 'humidity_air', 'humidity_soil',
+                   'luminosity', 'signature', 'manual', 'timestamp', 'idempotency_key']
+
+# Letture della tabella di appoggio con chiave nuova (o senza chiave) copiate in sensor_data e nei rollup
+INSERT_FROM_STAGING = ingest_sql('''
+    INSERT INTO sensor_data (sensor_id, zone, temperature, humidity_air, humidity_soil, luminosity, signature, manual, timestamp)
+    SELECT sensor_id, zone, temperature, humidity_air, humidity_soil, luminosity, signature, manual, timestamp
+    FROM sensor_data_staging
+    WHERE idempotency_key IS NULL OR idempotency_key IN (SELECT key FROM new_keys)
+''', ctes=['''new_keys AS (
+    INSERT INTO ingest_keys (key)
+    SELECT idempotency_key FROM sensor_data_staging WHERE idempotency_key IS NOT NULL
+    ON CONFLICT DO NOTHING
+    RETURNING key
+)'''])
+
+# Decodifica il corpo di una richiesta bulk: array JSON oppure NDJSON (un oggetto per riga)
+def parse_bulk_body(body: bytes, content_type: str = "") -> list:
+    text = body.decode()
+    if "ndjson" in content_type or not text.lstrip().startswith("["):
+        return [json.loads(line) for line in text.splitlines() if line.strip()]
+    items = json.loads(text)
+    if not isinstance(items, list):
+        raise ValueError("Expected a JSON array or NDJSON")
+    return items
+
+# Una lettura datata oltre i mesi partizionati in anticipo finirebbe nella DEFAULT
+def beyond_partitions(reading: SensorData) -> bool:
+    return reading.timestamp is not None and as_utc(reading.timestamp) >= partition_horizon()
+
+# ========== Letture JSON firmate: freschezza e reinvii ==========
+# Una lettura firmata catturata si può ripresentare identica: il timestamp (coperto dalla firma) deve
+# essere recente e la chiave di idempotenza è la firma stessa, comune a /data, /data/bulk e MQTT.
+# La finestra di accettazione sta dentro la durata delle chiavi: quando una chiave viene eliminata,
+# la sua lettura è già troppo vecchia per passare di nuovo
+READING_MAX_SKEW = timedelta(seconds=READING_MAX_SKEW_S)
+READING_MAX_AGE = timedelta(days=INGEST_KEY_TTL_DAYS) - READING_MAX_SKEW
+
+def reading_key(reading: SensorData) -> str:
+    return f"reading:{reading.sensor_id}:{reading.signature}"
+
+# Motivo dello scarto per timestamp, None se la lettura può entrare
+def reading_time_error(reading: SensorData) -> Optional[str]:
+    if reading.timestamp is None:
+        return 'Missing timestamp'
+    if beyond_partitions(reading):
+        return 'Timestamp beyond partitions'
+    now = datetime.now(timezone.utc)
+    if as_utc(reading.timestamp) < now - READING_MAX_AGE:
+        return 'Stale timestamp'
+    if as_utc(reading.timestamp) > now + READING_MAX_SKEW:
+        return 'Timestamp in the future'
+    return None
+
+# Valida una lettura JSON firmata e le assegna la chiave di idempotenza; None se valida, altrimenti il motivo
+def check_signed_reading(reading: SensorData) -> Optional[str]:
+    error = reading_time_error(reading)
+    if error:
+        return error
+    if not verify_signature(reading.dict()):
+        return 'Invalid signature'
+    reading.idempotency_key = reading_key(reading)
+    return None
+
+# Valida le letture di un batch; restituisce le letture valide e gli scarti con il loro indice
+def validate_batch(items: list):
+    readings, rejected = [], []
+    seen_keys = set()
+    for index, item in enumerate(items):
+        try:
+            reading = SensorData(**item)
+        except (ValidationError, TypeError) as e:
+            rejected.append({'index': index, 'error': str(e)})
+            continue
+        error = check_signed_reading(reading)
+        if error:
+            rejected.append({'index': index, 'error': error})
+            continue
+        # Una lettura ripetuta nello stesso batch è un duplicato come un reinvio
+        if reading.idempotency_key in seen_keys:
+            continue
+        seen_keys.add(reading.idempotency_key)
+        readings.append(reading)
+    return readings, rejected
+
+# COPY del batch in una tabella temporanea e un solo INSERT ... SELECT, nella transazione del chiamante
+async def stage_and_insert(raw, readings: List[SensorData]):
+    now = datetime.now(timezone.utc)
+    records = [(r.sensor_id, r.zone, r.temperature, r.humidity_air, r.humidity_soil, r.luminosity,
+                r.signature, r.manual, r.timestamp or now, r.idempotency_key) for r in readings]
+    await raw.execute('''
+    CREATE TEMP TABLE sensor_data_staging (
+        sensor_id TEXT, zone TEXT, temperature REAL, humidity_air REAL,
+        humidity_soil REAL, luminosity REAL, signature TEXT, manual BOOLEAN,
+        timestamp TIMESTAMPTZ, idempotency_key TEXT
+    ) ON COMMIT DROP
+    ''')
+    await raw.copy_records_to_table('sensor_data_staging', records=records, columns=STAGING_COLUMNS)
+    return await raw.fetch(INSERT_FROM_STAGING)
+
+# Salva un batch in una transazione
+async def save_batch_to_db(readings: List[SensorData]) -> int:
+    await ensure_partitions(r.timestamp or datetime.now(timezone.utc) for r in readings)
+    async with database.connection() as connection:
+        async with connection.transaction():
+            rows = await stage_and_insert(connection.raw_connection, readings)  # Connessione asyncpg: COPY binario
+
+    await after_ingest(rows)
+    return len(rows)
+
+# ========== Trame autenticate dei nodi LoRa ==========
+# Nodi ammessi: device id -> sensor_id e zona (sezione nodi di config.yml)
+def load_nodes(path):
+    try:
+        with open(path) as f:
+            config = yaml.safe_load(f) or {}
+    except OSError as e:
+        logging.warning(f"Nodi LoRa non letti ({e}): /frames rifiuta tutte le trame")
+        config = {}
+    return {int(device): {'sensor_id': node.get('sensor_id', f"node_{device}"), 'zone': node.get('zone', 'default')}
+            for device, node in (config.get('nodi') or {}).items()}
+
+nodes = load_nodes(CONFIG_FILE)
+
+# Chiavi dei dispositivi derivate da FRAME_MASTER_KEY, con lo stato HMAC già preparato per dispositivo
+frame_keys = frame_auth.KeyCache()
+
+LOCK_COUNTERS = '''
+SELECT device_id, counter FROM frame_counters
+WHERE device_id = ANY($1::bigint[]) ORDER BY device_id FOR UPDATE
+'''
+
+# Con due richieste in parallelo per lo stesso nodo nuovo, l'upsert rivaluta il contatore dopo l'altra
+ADVANCE_COUNTERS = '''
+INSERT INTO frame_counters AS c (device_id, counter)
+SELECT * FROM unnest($1::bigint[], $2::bigint[])
+ON CONFLICT (device_id) DO UPDATE SET counter = EXCLUDED.counter, updated_at = CURRENT_TIMESTAMP
+WHERE c.counter < EXCLUDED.counter
+RETURNING device_id
+'''
+
+# Letture delle trame: istante della misura = ricezione meno l'età riportata dal nodo
+def frame_readings(frames, received_at) -> List[SensorData]:
+    readings = []
+    for frame in frames:
+        node = nodes[frame.device_id]
+        for r in frame.readings:
+            readings.append(SensorData(**node, **{m: r[m] for m in METRICHE}, signature=frame.tag.hex(),
+                                       timestamp=received_at - timedelta(seconds=r['age'])))
+    return readings
+
+# Salva le trame verificate; il contatore di ogni nodo avanza nella stessa transazione delle letture,
+# quindi una trama già salvata (o più vecchia dell'ultima accettata) viene scartata come replay
+async def save_frames_to_db(frames, received_at):
+    await ensure_partitions(received_at - timedelta(seconds=r['age']) for f in frames for r in f.readings)
+    async with database.connection() as connection:
+        async with connection.transaction():
+            raw = connection.raw_connection
+            stored = {r['device_id']: r['counter']
+                      for r in await raw.fetch(LOCK_COUNTERS, sorted({f.device_id for f in frames}))}
+            accepted, replayed, last = [], [], {}
+            for frame in sorted(frames, key=lambda f: (f.device_id, f.counter)):
+                if frame.counter <= last.get(frame.device_id, stored.get(frame.device_id, -1)):
+                    replayed.append(frame)
+                    continue
+                last[frame.device_id] = frame.counter
+                accepted.append(frame)
+
+            advanced = {r['device_id'] for r in await raw.fetch(ADVANCE_COUNTERS, list(last), list(last.values()))}
+            replayed += [f for f in accepted if f.device_id not in advanced]
+            accepted = [f for f in accepted if f.device_id in advanced]
+            rows = await stage_and_insert(raw, frame_readings(accepted, received_at)) if accepted else []
+
+    await after_ingest(rows)
+    return accepted, replayed, len(rows)
+
+# ========== Cache Redis ==========
+# Contatori e latenze del backend, esposti da /metrics
+class Metrics:
+    def __init__(self, samples=1000):
+        self.counters = defaultdict(int)
+        self.latencies = defaultdict(lambda: deque(maxlen=samples))  # Ultimi campioni per nome
+
+    def inc(self, name, value=1):
+        self.counters[name] += value
+
+    def observe(self, name, seconds):
+        self.latencies[name].append(seconds)
+
+    def snapshot(self):
+        latency = {}
+        for name, samples in self.latencies.items():
+            ordered = sorted(samples)
+            if ordered:
+                latency[name] = {
+                    'count': len(ordered),
+                    'p50_ms': round(1000 * ordered[len(ordered) // 2], 3),
+                    'p99_ms': round(1000 * ordered[min(len(ordered) - 1, int(len(ordered) * 0.99))], 3),
+                }
+        return {'counters': dict(self.counters), 'latency': latency}
+
+metrics = Metrics()
+
+ZONE_BUCKET_SECONDS = 300  # Bucket delle finestre mobili per zona
+
+# Aggiorna l'ultima lettura di un sensore solo se più recente di quella in cache
+# (i batch possono arrivare fuori ordine). ARGV: sensor_id, epoch, JSON, ...
+LATEST_SCRIPT = redis_client.register_script('''
+for i = 1, #ARGV, 3 do
+    local current = redis.call('HGET', KEYS[2], ARGV[i])
+    if not current or tonumber(current) <= tonumber(ARGV[i + 1]) then
+        redis.call('HSET', KEYS[2], ARGV[i], ARGV[i + 1])
+        redis.call('HSET', KEYS[1], ARGV[i], ARGV[i + 2])
+    end
+end
+''')
+
+# Nuova generazione per i giorni toccati, presa da una sequenza globale che non scade: un giorno la
+# cui chiave è scaduta non riparte da 1, quindi non ritrova risultati in cache calcolati prima.
+# KEYS: sequenza, giorni; ARGV: durata delle chiavi dei giorni (s)
+GENERATION_SCRIPT = redis_client.register_script('''
+local generation = redis.call('INCR', KEYS[1])
+for i = 2, #KEYS do
+    redis.call('SET', KEYS[i], generation, 'EX', ARGV[1])
+end
+''')
+
+def zone_key(zone, bucket):
+    return f"zone:{zone}:{bucket}"
+
+# Write-through: ultima lettura per sensore, finestre per zona e generazioni dei giorni toccati.
+# Un errore di Redis non fa fallire l'ingest: i dati sono già nel database
+async def cache_readings(rows):
+    if not rows:
+        return
+    oldest = time.time() - ZONE_WINDOW_MINUTES * 60
+    latest, zones, days = {}, defaultdict(lambda: defaultdict(float)), set()
+    for row in rows:
+        epoch = row['timestamp'].timestamp()
+        if row['sensor_id'] not in latest or latest[row['sensor_id']][0] <= epoch:
+            latest[row['sensor_id']] = (epoch, row)
+        days.add(row['timestamp'].astimezone(timezone.utc).date())
+        if epoch >= oldest:
+            stats = zones[(row['zone'], int(epoch // ZONE_BUCKET_SECONDS) * ZONE_BUCKET_SECONDS)]
+            stats['n'] += 1
+            for m in METRICHE:
+                present = row[m] is not None  # Metriche mancanti (nodi senza sonda) fuori dalla media
+                stats[f'{m}_n'] += present
+                if present:
+                    stats[f'{m}_sum'] += row[m]
+                    stats[f'{m}_sq'] += row[m] * row[m]
+
+    start = time.perf_counter()
+    try:
+        async with redis_client.pipeline(transaction=False) as pipe:
+            args = []
+            for sensor_id, (epoch, row) in latest.items():
+                args += [sensor_id, epoch, json.dumps(dict(row), default=json_default)]
+            await LATEST_SCRIPT(keys=['latest', 'latest:epoch'], args=args, client=pipe)
+            for (zone, bucket), stats in zones.items():
+                pipe.sadd('zones', zone)
+                for field, value in stats.items():
+                    pipe.hincrbyfloat(zone_key(zone, bucket), field, value)
+                pipe.expire(zone_key(zone, bucket), ZONE_WINDOW_MINUTES * 60 + ZONE_BUCKET_SECONDS)
+            # Nuova generazione per ogni giorno toccato: i risultati in cache di quei giorni decadono
+            if days:
+                await GENERATION_SCRIPT(keys=['cache:gen:seq'] + [f"cache:gen:{day}" for day in days],
+                                        args=[QUERY_CACHE_TTL + 60], client=pipe)
+            await pipe.execute()
+    except redis.RedisError as e:
+        metrics.inc('cache_errors')
+        logging.warning(f"Cache non aggiornata: {e}")
+    metrics.observe('cache_write', time.perf_counter() - start)
+
+# Ultima lettura di ogni sensore dal database (cache vuota o Redis non raggiungibile)
+async def latest_from_db():
+    rows = await database.fetch_all(f'''
+    SELECT DISTINCT ON (sensor_id) sensor_id, zone, timestamp, {', '.join(METRICHE)}
+    FROM sensor_data ORDER BY sensor_id, timestamp DESC
+    ''')
+    return [dict(row) for row in rows]
+
+# Riempie la cache delle ultime letture all'avvio, se Redis è vuoto
+async def warm_latest_cache():
+    try:
+        if not await redis_client.exists('latest'):
+            await cache_readings(await latest_from_db())
+    except redis.RedisError as e:
+        logging.warning(f"Cache non inizializzata: {e}")
+
+# Statistiche per zona (n, media, deviazione standard) dai bucket della finestra mobile
+def zone_stats(buckets):
+    n = sum(float(b.get('n', 0)) for b in buckets)
+    stats = {'n': int(n)}
+    for m in METRICHE:
+        count = sum(float(b.get(f'{m}_n', b.get('n', 0))) for b in buckets)  # Bucket senza {m}_n: valeva n
+        total = sum(float(b.get(f'{m}_sum', 0)) for b in buckets)
+        squares = sum(float(b.get(f'{m}_sq', 0)) for b in buckets)
+        stats[f'{m}_mean'] = total / count if count else None
+        stats[f'{m}_std'] = ((max(squares - total * total / count, 0) / (count - 1)) ** 0.5) if count > 1 else None
+    return stats
+
+# Stato corrente dalla cache: una lettura per sensore e una finestra per zona, due round trip
+async def state_from_cache():
+    async with redis_client.pipeline(transaction=False) as pipe:
+        latest, zones = await pipe.hgetall('latest').smembers('zones').execute()
+
+    now = int(time.time() // ZONE_BUCKET_SECONDS) * ZONE_BUCKET_SECONDS
+    buckets = range(now - ZONE_WINDOW_MINUTES * 60 + ZONE_BUCKET_SECONDS, now + 1, ZONE_BUCKET_SECONDS)
+    zones = sorted(zones)
+    async with redis_client.pipeline(transaction=False) as pipe:
+        for zone in zones:
+            for bucket in buckets:
+                pipe.hgetall(zone_key(zone, bucket))
+        results = await pipe.execute()
+
+    per_zone = len(buckets)
+    return ([json.loads(latest[s]) for s in sorted(latest)],
+            {zone: zone_stats(results[i * per_zone:(i + 1) * per_zone]) for i, zone in enumerate(zones)})
+
+# Chiave di cache di una query: parametri e generazioni dei giorni dell'intervallo
+# (None = non cacheabile: intervallo troppo lungo)
+async def query_cache_key(endpoint, params, start, end):
+    first, last = start.date(), (end - timedelta(microseconds=1)).date()
+    if (last - first).days >= QUERY_CACHE_MAX_DAYS:
+        return None
+    days = [first + timedelta(days=i) for i in range((last - first).days + 1)]
+    generations = await redis_client.mget([f"cache:gen:{day}" for day in days])
+    # Gli istanti esatti distinguono finestre diverse negli stessi giorni (o in giorni mai scritti)
+    digest = hashlib.sha1(json.dumps([endpoint, start.isoformat(), end.isoformat(),
+                                      sorted(params.items()), generations],
+                                     default=str).encode()).hexdigest()
+    return f"cache:query:{digest}"
+
+# Risposta JSON di una query sull'intervallo [start, end), dalla cache se i giorni non sono cambiati
+async def cached_response(endpoint, params, start, end, compute):
+    key = None
+    lookup = time.perf_counter()
+    try:
+        key = await query_cache_key(endpoint, params, start, end)
+        payload = await redis_client.get(key) if key else None
+    except redis.RedisError as e:
+        metrics.inc('cache_errors')
+        logging.warning(f"Cache non disponibile: {e}")
+        payload = None
+    metrics.observe('cache_lookup', time.perf_counter() - lookup)
+
+    if payload is not None:
+        metrics.inc('cache_hits')
+        return Response(content=payload, media_type="application/json")
+
+    metrics.inc('cache_misses' if key else 'cache_bypass')
+    query_start = time.perf_counter()
+    payload = json.dumps(await compute(), default=json_default)
+    metrics.observe(f'db_{endpoint}', time.perf_counter() - query_start)
+    if key:
+        try:
+            await redis_client.set(key, payload, ex=QUERY_CACHE_TTL)
+        except redis.RedisError as e:
+            metrics.inc('cache_errors')
+            logging.warning(f"Risultato non salvato in cache: {e}")
+    return Response(content=payload, media_type="application/json")
+
+# ========== Flusso delle modifiche ==========
+# Le righe salvate finiscono, dopo il commit, nello stream Redis CHANGES_STREAM: gli id dello
+# stream sono crescenti nell'ordine dei commit e fanno da cursore per /changes e /stream
+CHANGES_STREAM = 'changes'
+CHANGES_CHUNK = 1000  # Righe massime per voce dello stream
+
+# Id di una voce dello stream ("ms-seq") come tupla confrontabile
+def stream_id(value: str):
+    ms, seq = value.split('-')
+    return int(ms), int(seq)
+
+# Aggiunge allo stream righe di un tipo ('readings', ...), a blocchi di CHANGES_CHUNK
+async def publish_changes(kind, rows):
+    if not rows:
+        return
+    try:
+        async with redis_client.pipeline(transaction=False) as pipe:
+            for start in range(0, len(rows), CHANGES_CHUNK):
+                chunk = [dict(row) for row in rows[start:start + CHANGES_CHUNK]]
+                pipe.xadd(CHANGES_STREAM, {'type': kind, 'data': json.dumps(chunk, default=json_default)},
+                          maxlen=CHANGES_STREAM_MAXLEN, approximate=True)
+            await pipe.execute()
+    except redis.RedisError as e:
+        metrics.inc('changes_errors')
+        logging.warning(f"Modifiche non pubblicate: {e}")
+
+# Dopo il commit di un ingest: cache, flusso delle modifiche e anomalie
+async def after_ingest(rows):
+    await cache_readings(rows)
+    await publish_changes('readings', rows)
+    await detect_anomalies(rows)
+
+# Id dell'ultima voce dello stream ('0-0' se vuoto)
+async def changes_head():
+    last = await redis_client.xrevrange(CHANGES_STREAM, count=1)
+    return last[0][0] if last else '0-0'
+
+# Voci successive a since; reset=True se il MAXLEN dello stream ha già eliminato voci
+# successive a since (anche la voce since stessa) e il client deve ricaricare tutto
+async def read_changes(since, limit):
+    entries = await redis_client.xrange(CHANGES_STREAM, min=f'({since}', count=limit)
+    reset = False
+    if await redis_client.exists(CHANGES_STREAM):
+        info = await redis_client.xinfo_stream(CHANGES_STREAM)
+        first = info.get('first-entry')
+        if first and stream_id(first[0]) > stream_id(since):
+            # since = '0-0' è il cursore di uno stream vuoto: perdite solo se lo stream è stato accorciato
+            reset = since != '0-0' or info.get('entries-added', 0) > info['length']
+    return entries, reset
+
+# Smista le voci nuove dello stream ai client di /stream: una sola lettura bloccante su Redis
+# per processo, una coda limitata per client
+class Broadcaster:
+    def __init__(self, queue_size=1000):
+        self.queue_size = queue_size
+        self.subscribers = set()
+
+    def subscribe(self):
+        queue = asyncio.Queue(maxsize=self.queue_size)
+        self.subscribers.add(queue)
+        return queue
+
+    def unsubscribe(self, queue):
+        self.subscribers.discard(queue)
+
+    def publish(self, item):
+        for queue in list(self.subscribers):
+            try:
+                queue.put_nowait(item)
+            except asyncio.QueueFull:
+                # Client troppo lento: riceve un reset e si riallinea riconnettendosi con Last-Event-ID
+                self.subscribers.discard(queue)
+                queue.get_nowait()
+                queue.put_nowait(None)
+                metrics.inc('stream_lagging')
+
+    async def run(self):
+        last = None
+        while True:
+            try:
+                last = last or await changes_head()
+                response = await redis_client.xread({CHANGES_STREAM: last}, count=100, block=15000)
+            except redis.RedisError as e:
+                logging.warning(f"Lettura dello stream delle modifiche fallita: {e}")
+                await asyncio.sleep(1)
+                continue
+            for _, entries in response:
+                for entry_id, fields in entries:
+                    last = entry_id
+                    self.publish((entry_id, fields['type'], fields['data']))
+
+broadcaster = Broadcaster()
+
+# Evento SSE: l'id dello stream diventa Last-Event-ID alla riconnessione del client
+def sse_event(entry_id, kind, data):
+    return f"id: {entry_id}\nevent: {kind}\ndata: {data}\n\n"
+
+# Eventi per un client di /stream: prima le voci perse dopo since, poi quelle in diretta
+async def sse_events(since, kinds):
+    queue = broadcaster.subscribe()  # Prima del recupero: nessuna voce cade tra i due
+    try:
+        last = since
+        if since:
+            try:
+                entries, reset = await read_changes(since, SSE_REPLAY_MAX + 1)
+                # Voci già eliminate dal MAXLEN, o più di quante se ne recuperano: il client ricarica
+                # da /data e riparte dalla testa attuale, che diventa il suo Last-Event-ID
+                if reset or len(entries) > SSE_REPLAY_MAX:
+                    entries, last = [], await changes_head()
+                    yield f"id: {last}\nevent: reset\ndata: {{}}\n\n"
+            except redis.RedisError:
+                yield "event: reset\ndata: {}\n\n"  # Recupero impossibile: il client riprova
+                return
+            for entry_id, fields in entries:
+                last = entry_id
+                if fields['type'] in kinds:
+                    yield sse_event(entry_id, fields['type'], fields['data'])
+
+        while True:
+            try:
+                item = await asyncio.wait_for(queue.get(), SSE_KEEPALIVE_S)
+            except asyncio.TimeoutError:
+                yield ": keepalive\n\n"  # Tiene aperti proxy e connessioni inattive
+                continue
+            if item is None:
+                yield "event: reset\ndata: {}\n\n"
+                return
+            entry_id, kind, data = item
+            if last and stream_id(entry_id) <= stream_id(last):
+                continue  # Già inviata durante il recupero
+            last = entry_id
+            if kind in kinds:
+                yield sse_event(entry_id, kind, data)
+    finally:
+        broadcaster.unsubscribe(queue)
+
+# ========== Rilevamento delle anomalie ==========
+# Soglie e regole da config.yml (stesso file di firmware_mock.py)
+def load_anomaly_config(path):
+    try:
+        with open(path) as f:
+            config = yaml.safe_load(f) or {}
+    except OSError as e:
+        logging.warning(f"Configurazione anomalie non letta ({e}): solo regole di default")
+        config = {}
+    regole = config.get('anomalie', {})
+    return {
+        'soglie': config.get('soglie', {}),
+        'zscore': regole.get('zscore', 4.0),
+        'window': regole.get('finestra', 60),
+        'min_samples': regole.get('min_campioni', 20),
+        'max_rate': regole.get('variazione_oraria', {}),
+    }
+
+# Regole per lettura valutate in blocco su ogni batch di ingest (array n letture x metriche):
+# soglie fisse, z-score rispetto a media e varianza mobili (esponenziali) del sensore e
+# variazione oraria rispetto alla lettura precedente dello stesso sensore
+class AnomalyDetector:
+    def __init__(self, soglie, zscore=4.0, window=60, min_samples=20, max_rate=None):
+        self.low = np.array([soglie.get(m, (-np.inf, np.inf))[0] for m in METRICHE], dtype=float)
+        self.high = np.array([soglie.get(m, (-np.inf, np.inf))[1] for m in METRICHE], dtype=float)
+        self.max_rate = np.array([(max_rate or {}).get(m, np.inf) for m in METRICHE], dtype=float)
+        self.zscore = zscore
+        self.alpha = 2 / (window + 1)
+        self.min_samples = min_samples
+
+        # Stato per sensore, una riga per sensore
+        self.index = {}
+        self.count = np.zeros((0, len(METRICHE)))  # Letture viste per metrica
+        self.mean = np.zeros((0, len(METRICHE)))
+        self.var = np.zeros((0, len(METRICHE)))
+        self.last_value = np.full((0, len(METRICHE)), np.nan)
+        self.last_time = np.full(0, np.nan)
+
+    # Righe dello stato dei sensori, aggiunte per i sensori nuovi
+    def rows_for(self, sensor_ids):
+        new = [s for s in dict.fromkeys(sensor_ids) if s not in self.index]
+        if new:
+            for sensor_id in new:
+                self.index[sensor_id] = len(self.index)
+            grow = len(new)
+            self.count = np.concatenate([self.count, np.zeros((grow, len(METRICHE)))])
+            self.mean = np.concatenate([self.mean, np.zeros((grow, len(METRICHE)))])
+            self.var = np.concatenate([self.var, np.zeros((grow, len(METRICHE)))])
+            self.last_value = np.concatenate([self.last_value, np.full((grow, len(METRICHE)), np.nan)])
+            self.last_time = np.concatenate([self.last_time, np.full(grow, np.nan)])
+        return np.array([self.index[s] for s in sensor_ids], dtype=int)
+
+    # Stato iniziale da statistiche aggregate (sensor_id, n, conteggi, somme e quadrati per metrica)
+    # Una sola crescita degli array per tutti i sensori, poi assegnazioni vettoriali
+    def warm(self, stats):
+        if not stats:
+            return
+        idx = self.rows_for([row['sensor_id'] for row in stats])
+        count = np.array([[row['n'] if row.get(f'{m}_n') is None else row[f'{m}_n'] for m in METRICHE]
+                          for row in stats], dtype=float)
+        sums = np.array([[row[f'{m}_sum'] or 0 for m in METRICHE] for row in stats], dtype=float)
+        squares = np.array([[row[f'{m}_sq'] or 0 for m in METRICHE] for row in stats], dtype=float)
+        seen = count > 0  # Metriche senza campioni: media e varianza restano quelle di prima
+        mean = np.divide(sums, count, out=np.zeros_like(sums), where=seen)
+        var = np.maximum(np.divide(squares, count, out=np.zeros_like(squares), where=seen) - mean ** 2, 0)
+        self.mean[idx] = np.where(seen, mean, self.mean[idx])
+        self.var[idx] = np.where(seen, var, self.var[idx])
+        self.count[idx] = count
+
+    def evaluate(self, rows):
+        values = np.array([[r[m] for m in METRICHE] for r in rows], dtype=float)
+        times = np.array([r['timestamp'].timestamp() for r in rows])
+        idx = self.rows_for([r['sensor_id'] for r in rows])
+
+        # Letture raggruppate per sensore e in ordine di tempo
+        order = np.lexsort((times, idx))
+        values, times, idx = values[order], times[order], idx[order]
+        rows = [rows[i] for i in order]
+
+        # Soglie fisse
+        below, above = values < self.low, values > self.high
+        threshold = np.where(below, self.low, self.high)
+
+        # z-score rispetto allo stato del sensore prima del batch
+        std = np.sqrt(self.var[idx])
+        z = np.divide(values - self.mean[idx], std, out=np.zeros_like(values), where=std > 0)
+        outlier = (self.count[idx] >= self.min_samples) & (np.abs(z) > self.zscore)
+
+        # Variazione oraria: lettura precedente nel batch, altrimenti l'ultima vista. Sotto l'ora
+        # il limite resta quello di un'ora, così il rumore tra letture ravvicinate non viene amplificato
+        prev_value, prev_time = self.last_value[idx], self.last_time[idx]
+        same = np.r_[False, idx[1:] == idx[:-1]]
+        prev_value[same], prev_time[same] = values[np.nonzero(same)[0] - 1], times[np.nonzero(same)[0] - 1]
+        hours = (times - prev_time) / 3600
+        with np.errstate(invalid='ignore'):
+            rate = np.where((hours >= 0)[:, None], (values - prev_value) / np.maximum(hours, 1)[:, None], np.nan)
+            jump = np.abs(rate) > self.max_rate
+
+        self.update(idx, values, times)
+
+        anomalies = []
+        for rule, flags, limits, scores in (
+            ('soglia', below | above, threshold, values),
+            ('zscore', outlier, np.broadcast_to(self.zscore, values.shape), z),
+            ('variazione', jump, np.broadcast_to(self.max_rate, values.shape), rate),
+        ):
+            for i, j in zip(*np.nonzero(flags)):
+                anomalies.append({
+                    'reading_id': rows[i]['id'], 'sensor_id': rows[i]['sensor_id'], 'zone': rows[i]['zone'],
+                    'metric': METRICHE[j], 'rule': rule, 'value': float(values[i, j]),
+                    'threshold': float(limits[i, j]), 'score': float(scores[i, j]),
+                    'timestamp': rows[i]['timestamp'],
+                })
+        return anomalies
+
+    # Media e varianza mobili per sensore con le statistiche del batch: k letture pesano
+    # come k passi della media esponenziale. Le metriche mancanti (NaN) non toccano lo stato
+    def update(self, idx, values, times):
+        sensors, inverse = np.unique(idx, return_inverse=True)
+        valid = ~np.isnan(values)
+        filled = np.where(valid, values, 0)
+        sums, squares, k = (np.zeros((len(sensors), values.shape[1])) for _ in range(3))
+        np.add.at(sums, inverse, filled)
+        np.add.at(squares, inverse, filled * filled)
+        np.add.at(k, inverse, valid)
+        batch_mean = np.divide(sums, k, out=np.zeros_like(sums), where=k > 0)
+        batch_var = np.maximum(np.divide(squares, k, out=np.zeros_like(sums), where=k > 0) - batch_mean ** 2, 0)
+
+        fresh = self.count[sensors] == 0
+        w = np.where(k > 0, np.where(fresh, 1.0, 1 - (1 - self.alpha) ** k), 0.0)
+        delta = batch_mean - self.mean[sensors]
+        self.var[sensors] = (1 - w) * (self.var[sensors] + w * delta ** 2) + w * batch_var
+        self.mean[sensors] += w * delta
+        self.count[sensors] += k
+
+        # Ultima lettura di ogni sensore (ultima del suo gruppo), se più recente di quella nota
+        last = np.r_[np.nonzero(idx[1:] != idx[:-1])[0], len(idx) - 1]
+        newer = np.isnan(self.last_time[sensors]) | (times[last] >= self.last_time[sensors])
+        self.last_value[sensors[newer]] = values[last[newer]]
+        self.last_time[sensors[newer]] = times[last[newer]]
+
+anomaly_detector = AnomalyDetector(**load_anomaly_config(CONFIG_FILE))
+
+INSERT_ANOMALY = '''
+INSERT INTO anomalies (reading_id, sensor_id, zone, metric, rule, value, threshold, score, timestamp)
+VALUES (:reading_id, :sensor_id, :zone, :metric, :rule, :value, :threshold, :score, :timestamp)
+'''
+
+# Valuta le letture salvate; le anomalie vanno nella tabella anomalies e nel flusso delle modifiche
+async def detect_anomalies(rows):
+    if not rows:
+        return
+    try:
+        start = time.perf_counter()
+        anomalies = anomaly_detector.evaluate(rows)
+        metrics.observe('anomaly_eval', time.perf_counter() - start)
+        if anomalies:
+            await database.execute_many(INSERT_ANOMALY, anomalies)
+            await publish_changes('anomalies', anomalies)
+            metrics.inc('anomalies', len(anomalies))
+    except Exception as e:
+        metrics.inc('anomaly_errors')
+        logging.warning(f"Rilevamento anomalie fallito: {e}")
+
+# Media e varianza delle ultime 24 ore per sensore dai rollup orari: lo z-score è subito attivo
+async def warm_anomaly_detector():
+    sums = ", ".join(f"sum(COALESCE({m}_n, n)) AS {m}_n, sum({m}_sum) AS {m}_sum, sum({m}_sq) AS {m}_sq"
+                     for m in METRICHE)
+    rows = await database.fetch_all(f'''
+    SELECT sensor_id, sum(n) AS n, {sums} FROM sensor_rollup_1h
+    WHERE bucket >= CURRENT_TIMESTAMP - INTERVAL '24 hours'
+    GROUP BY sensor_id
+    ''')
+    anomaly_detector.warm([dict(row) for row in rows])
 
 # ========== Funzioni per monitorare MQTT ==========
-# Callback per ricevere i messaggi MQTT
+# Pipeline di ingest MQTT: il thread di paho valida i messaggi e li mette in una coda limitata;
+# un worker asincrono li salva a batch (per dimensione o per tempo) e solo dopo il commit
+# conferma al broker i messaggi QoS 1. Con la sessione persistente (clean_session=False) i
+# messaggi non confermati vengono riconsegnati alla riconnessione: niente letture perse.
+mqtt_queue: Optional[asyncio.Queue] = None
+mqtt_client: Optional[mqtt.Client] = None
+mqtt_loop: Optional[asyncio.AbstractEventLoop] = None
+
+# Valida un messaggio MQTT; None (e messaggio scartato) se non è una lettura firmata valida
+def parse_mqtt_message(payload: bytes) -> Optional[SensorData]:
+    try:
+        reading = SensorData(**json.loads(payload.decode()))
+    except (ValueError, TypeError, ValidationError):  # ValueError include JSON e UTF-8 non validi
+        return None
+    # La chiave derivata dalla firma scarta anche le riconsegne QoS 1 dopo un commit non confermato
+    if check_signed_reading(reading):
+        return None
+    return reading
+
+# Callback per ricevere i messaggi MQTT (thread di paho)
 def on_message(client, userdata, msg):
-    payload = json.loads(msg.payload.decode())  # Decodifica il payload del messaggio
-    print(f"Messaggio ricevuto: {payload}")
+    metrics.inc('mqtt_received')
+    reading = parse_mqtt_message(msg.payload)
+    if reading is None:
+        metrics.inc('mqtt_invalid')
+        client.ack(msg.mid, msg.qos)  # Riconsegnarlo non lo renderebbe valido
+        return
+
+    item = (reading, msg.mid, msg.qos)
+    if msg.qos == 0:
+        # QoS 0 non verrebbe riconsegnato: con la coda piena si scarta e si conta
+        def put_or_drop():
+            try:
+                mqtt_queue.put_nowait(item)
+            except asyncio.QueueFull:
+                metrics.inc('mqtt_dropped')
+        mqtt_loop.call_soon_threadsafe(put_or_drop)
+    else:
+        # QoS 1: con la coda piena il thread di paho si ferma e smette di leggere dal socket,
+        # così la contropressione arriva fino al broker
+        asyncio.run_coroutine_threadsafe(mqtt_queue.put(item), mqtt_loop).result()
+
+# Sottoscrizione a ogni (ri)connessione
+def on_connect(client, userdata, flags, reason_code, properties):
+    if reason_code.is_failure:
+        logging.warning(f"Connessione MQTT rifiutata: {reason_code}")
+        return
+    client.subscribe(MQTT_TOPIC, qos=MQTT_QOS)  # Sottoscrivi al topic
+    print(f"MQTT connesso a {MQTT_BROKER}:{MQTT_PORT}, topic {MQTT_TOPIC} (QoS {MQTT_QOS})")
+
+# Prende dalla coda un batch: al massimo MQTT_BATCH_SIZE letture o quelle arrivate in MQTT_FLUSH_MS
+async def next_mqtt_batch():
+    batch = [await mqtt_queue.get()]
+    deadline = mqtt_loop.time() + MQTT_FLUSH_MS / 1000
+    while len(batch) < MQTT_BATCH_SIZE:
+        if not mqtt_queue.empty():
+            batch.append(mqtt_queue.get_nowait())
+            continue
+        timeout = deadline - mqtt_loop.time()
+        if timeout <= 0:
+            break
+        try:
+            batch.append(await asyncio.wait_for(mqtt_queue.get(), timeout))
+        except asyncio.TimeoutError:
+            break
+    return batch
+
+# Errori dovuti al contenuto delle letture (es. un valore fuori dal range di REAL, che l'encoder COPY
+# segnala con ValueError): riprovare non servirebbe
+DATA_ERRORS = (asyncpg.exceptions.DataError, asyncpg.exceptions.IntegrityConstraintViolationError,
+               ValueError, TypeError)
+
+# Salva le letture dividendo a metà il batch che contiene letture non salvabili, fino a isolarle;
+# restituisce le righe inserite e le letture scartate
+async def save_bisecting(readings):
+    try:
+        return await save_batch_to_db(readings), []
+    except DATA_ERRORS as e:
+        if len(readings) == 1:
+            logging.warning(f"Lettura MQTT di {readings[0].sensor_id} scartata: {e}")
+            return 0, readings
+    half = len(readings) // 2
+    first, bad_first = await save_bisecting(readings[:half])
+    second, bad_second = await save_bisecting(readings[half:])
+    return first + second, bad_first + bad_second
+
+# Salva un batch riprovando finché il database non risponde, poi conferma i messaggi. Le letture
+# non salvabili vengono confermate e contate come non valide invece di bloccare il worker
+async def flush_mqtt_batch(batch):
+    readings, seen = [], set()
+    for reading, _, _ in batch:
+        if reading.idempotency_key not in seen:  # Una riconsegna può finire nello stesso batch
+            seen.add(reading.idempotency_key)
+            readings.append(reading)
+    backoff = 0.5
+    while True:
+        start = time.perf_counter()
+        try:
+            # Le metà già salvate di un tentativo fallito sono duplicati al successivo (chiavi di idempotenza)
+            inserted, bad = await save_bisecting(readings)
+            break
+        except Exception as e:
+            metrics.inc('mqtt_flush_errors')
+            logging.warning(f"Batch MQTT non salvato, nuovo tentativo tra {backoff:.1f} s: {e}")
+            await asyncio.sleep(backoff)
+            backoff = min(backoff * 2, 30)
+    metrics.observe('mqtt_flush', time.perf_counter() - start)
+    metrics.inc('mqtt_flushed', len(batch))
+    metrics.inc('mqtt_invalid', len(bad))
+    metrics.inc('mqtt_duplicates', len(batch) - inserted - len(bad))
+
+    for _, mid, qos in batch:
+        if qos > 0:
+            mqtt_client.ack(mid, qos)
+
+async def mqtt_flush_worker():
+    while True:
+        await flush_mqtt_batch(await next_mqtt_batch())
 
 # Funzione per avviare il listener MQTT
 def start_mqtt_listener():
-    client = mqtt.Client()
-    client.on_message = on_message  # Imposta il callback per i messaggi
-    client.connect(MQTT_BROKER, MQTT_PORT)  # Connetti al broker MQTT
-    client.subscribe(MQTT_TOPIC)  # Sottoscrivi al topic
-    client.loop_forever()  # Inizia a ricevere messaggi in loop
+    mqtt_client.connect_async(MQTT_BROKER, MQTT_PORT)  # Connetti al broker MQTT
+    mqtt_client.loop_forever(retry_first_connection=True)  # Inizia a ricevere messaggi in loop, riconnettendosi
 
 # Funzione che avvia il listener MQTT all'avvio dell'app
 @app.on_event("startup")
 async def start_mqtt():
+    global mqtt_queue, mqtt_client, mqtt_loop
     if USE_MQTT:
+        mqtt_loop = asyncio.get_running_loop()
+        mqtt_queue = asyncio.Queue(maxsize=MQTT_QUEUE_SIZE)
+        mqtt_client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=MQTT_CLIENT_ID,
+                                  clean_session=False, manual_ack=True)
+        mqtt_client.on_connect = on_connect
+        mqtt_client.on_message = on_message  # Imposta il callback per i messaggi
+        asyncio.create_task(mqtt_flush_worker())
         thread = threading.Thread(target=start_mqtt_listener, daemon=True)  # Avvia il listener in un thread separato
         thread.start()
         print("MQTT listener avviato")
 
 # ========== Funzione per validare la firma ==========
-# Funzione per validare la firma dei dati ricevuti
+# Firma di una lettura JSON: HMAC della sua forma canonica con la chiave del sensore (frame_auth.py)
 def verify_signature(data: dict) -> bool:
-    return data.get('signature', '').startswith('signature_')  # Verifica che la firma inizi con 'signature_'
+    return frame_auth.verify_reading(frame_keys, data)
 
 # ========== Funzioni per le API ==========
 # Funzione per la root
@@ -177,45 +1282,396 @@ async def read_root():
     """
     return {"message": "Welcome to the sensor data API"}
 
+# ========== Funzioni per la query dei dati ==========
+# Colonne restituibili da /data; id e timestamp sono sempre inclusi perché formano il cursore
+DATA_COLUMNS = ['id', 'sensor_id', 'zone', 'temperature', 'humidity_air', 'humidity_soil',
+                'luminosity', 'signature', 'manual', 'timestamp']
+
+# Cursore opaco: timestamp e id dell'ultima riga restituita
+def encode_cursor(row) -> str:
+    return base64.urlsafe_b64encode(f"{row['timestamp'].isoformat()}|{row['id']}".encode()).decode()
+
+def decode_cursor(cursor: str):
+    timestamp, row_id = base64.urlsafe_b64decode(cursor.encode()).decode().split('|')
+    return datetime.fromisoformat(timestamp), int(row_id)
+
+# Intervallo richiesto; senza date vengono considerati tutti i dati
+def parse_range(start_date, end_date, start_time, end_time):
+    if not start_date or not end_date:
+        return datetime(2000, 1, 1, 0, 0, 0), datetime.now()
+    return (datetime.strptime(f"{start_date} {start_time}", '%Y-%m-%d %H:%M:%S'),
+            datetime.strptime(f"{end_date} {end_time}", '%Y-%m-%d %H:%M:%S'))
+
+# Colonne da selezionare per ?fields= (lista separata da virgole)
+def parse_fields(fields: Optional[str]) -> List[str]:
+    if not fields:
+        return DATA_COLUMNS
+    requested = [f.strip() for f in fields.split(',') if f.strip()]
+    unknown = [f for f in requested if f not in DATA_COLUMNS]
+    if unknown:
+        raise ValueError(f"Unknown fields: {', '.join(unknown)}")
+    return [c for c in DATA_COLUMNS if c in requested or c in ('id', 'timestamp')]
+
+# Query a keyset: ordinata per (timestamp, id) decrescenti, riparte dopo il cursore
+def build_data_query(start_datetime, end_datetime, columns, sensor_ids=None, zones=None,
+                     cursor=None, limit=None):
+    conditions = ['timestamp >= :start_datetime', 'timestamp <= :end_datetime']
+    values = {'start_datetime': start_datetime, 'end_datetime': end_datetime}
+
+    if sensor_ids:
+        conditions.append('sensor_id = ANY(:sensor_ids)')
+        values['sensor_ids'] = sensor_ids
+    if zones:
+        conditions.append('zone = ANY(:zones)')
+        values['zones'] = zones
+    if cursor:
+        conditions.append('(timestamp, id) < (:cursor_timestamp, :cursor_id)')
+        values['cursor_timestamp'], values['cursor_id'] = decode_cursor(cursor)
+
+    query = f"SELECT {', '.join(columns)} FROM sensor_data WHERE {' AND '.join(conditions)} ORDER BY timestamp DESC, id DESC"
+    if limit is not None:
+        query += " LIMIT :limit"
+        values['limit'] = limit
+    return query, values
+
+# Serializza i valori non JSON (timestamp) nello stesso formato ISO della risposta JSON
+def json_default(value):
+    if isinstance(value, datetime):
+        return value.isoformat()
+    return str(value)
+
+# Righe come NDJSON, una alla volta dal cursore del database: memoria costante
+async def stream_ndjson(query, values):
+    async for row in database.iterate(query, values=values):
+        yield json.dumps(dict(row), default=json_default) + "\n"
+
+# Elenco separato da virgole -> lista (None se vuoto)
+def split_list(value: Optional[str]):
+    return [v.strip() for v in value.split(',') if v.strip()] if value else None
+
 # Funzione per ottenere i dati del sensore
 @app.get("/data")
 async def get_data(
     start_date: str = Query(None, description="Data di inizio in formato 'YYYY-MM-DD'"),
     end_date: str = Query(None, description="Data di fine in formato 'YYYY-MM-DD'"),
     start_time: str = Query("00:00:00", description="Orario di inizio in formato 'HH:MM:SS'"),
-    end_time: str = Query("23:59:59", description="Orario di fine in formato 'HH:MM:SS'")
+    end_time: str = Query("23:59:59", description="Orario di fine in formato 'HH:MM:SS'"),
+    sensor_id: str = Query(None, description="Filtro sui sensori, separati da virgola"),
+    zone: str = Query(None, description="Filtro sulle zone, separate da virgola"),
+    fields: str = Query(None, description="Colonne da restituire, separate da virgola"),
+    cursor: str = Query(None, description="next_cursor della pagina precedente"),
+    limit: int = Query(None, description="Righe per pagina (JSON) o totali (NDJSON)"),
+    format: str = Query("json", description="'json' a pagine oppure 'ndjson' in streaming")
 ):
     """
     Endpoint per recuperare i dati filtrati dal database in base a un intervallo di data e orario.
     Se non sono specificate le date, verranno recuperati tutti i dati.
+    In formato JSON i dati arrivano a pagine: next_cursor (null sull'ultima pagina) va passato
+    come cursor per la pagina successiva. In formato NDJSON l'intervallo viene inviato in streaming.
     """
     logging.debug(f"Received GET request for /data with params: start_date={start_date}, end_date={end_date}")
     try:
-        # Se non sono specificate start_date e end_date, usa una data di default
-        if not start_date or not end_date:
-            start_datetime = datetime(2000, 1, 1, 0, 0, 0)
-            end_datetime = datetime.now()
-        else:
-            start_datetime_str = f"{start_date} {start_time}"
-            end_datetime_str = f"{end_date} {end_time}"
-            start_datetime = datetime.strptime(start_datetime_str, '%Y-%m-%d %H:%M:%S')
-            end_datetime = datetime.strptime(end_datetime_str, '%Y-%m-%d %H:%M:%S')
+        start_datetime, end_datetime = parse_range(start_date, end_date, start_time, end_time)
+        columns = parse_fields(fields)
+        if cursor:
+            decode_cursor(cursor)
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=f"Invalid parameters: {str(e)}")
+    if format not in ("json", "ndjson"):
+        raise HTTPException(status_code=400, detail="format must be 'json' or 'ndjson'")
 
-        # Query per ottenere i dati dal database
-        query = """
-        SELECT * FROM sensor_data
-        WHERE timestamp >= :start_datetime
-        AND timestamp <= :end_datetime
-        ORDER BY timestamp DESC;
-        """
+    if format == "ndjson":
+        query, values = build_data_query(start_datetime, end_datetime, columns,
+                                         split_list(sensor_id), split_list(zone), cursor, limit)
+        return StreamingResponse(stream_ndjson(query, values), media_type="application/x-ndjson")
 
-        rows = await database.fetch_all(query, values={'start_datetime': start_datetime, 'end_datetime': end_datetime})
+    page_size = min(limit or DATA_PAGE_SIZE, DATA_PAGE_MAX)
 
-        return {"status": "success", "data": [dict(row) for row in rows]}
+    async def fetch_page():
+        # Una riga in più indica se esiste una pagina successiva
+        query, values = build_data_query(start_datetime, end_datetime, columns,
+                                         split_list(sensor_id), split_list(zone), cursor, page_size + 1)
+        rows = [dict(row) for row in await database.fetch_all(query, values=values)]
+
+        next_cursor = encode_cursor(rows[page_size - 1]) if len(rows) > page_size else None
+        return {"status": "success", "data": rows[:page_size], "next_cursor": next_cursor}
+
+    try:
+        params = {'sensor_id': sensor_id, 'zone': zone, 'fields': ','.join(columns),
+                  'cursor': cursor, 'limit': page_size}
+        return await cached_response('data', params, start_datetime, end_datetime + timedelta(seconds=1), fetch_page)
 
     except Exception as e:
         raise HTTPException(status_code=500, detail=f"Error fetching data: {str(e)}")
 
+# ========== Funzioni per le aggregazioni ==========
+# Raggruppamenti di /data/aggregate: colonne di raggruppamento e colonne restituite
+GROUP_BY = {
+    'all': ([], []),
+    'zone': (['zone'], ['zone']),
+    'sensor': (['sensor_id'], ['sensor_id', 'max(zone) AS zone']),
+}
+
+STEP_UNITS = {'s': 1, 'm': 60, 'h': 3600, 'd': 86400}
+
+# Passo dei bucket: '15m', '1h', '7d'... in secondi, 'total' = un solo bucket, None = automatico
+def parse_step(step: Optional[str]):
+    if not step or step == 'total':
+        return step or None
+    match = re.fullmatch(r'(\d+)([smhd])', step)
+    if not match or int(match.group(1)) == 0:
+        raise ValueError(f"Invalid step '{step}'")
+    return int(match.group(1)) * STEP_UNITS[match.group(2)]
+
+# Un istante cade sul bordo dei bucket di questa durata (date senza fuso = UTC)
+def aligned(moment, seconds):
+    origin = datetime(2000, 1, 1, tzinfo=timezone.utc)
+    if moment.tzinfo is None:
+        moment = moment.replace(tzinfo=timezone.utc)
+    return (moment - origin) % timedelta(seconds=seconds) == timedelta(0)
+
+# Rollup utilizzabili per [start, end): bucket interi dentro l'intervallo, dal più grosso;
+# oltre adesso non ci sono ancora dati, quindi la fine conta solo se è nel passato
+def usable_rollups(start, end):
+    now = datetime.now(timezone.utc)
+    if end.tzinfo is None:
+        now = now.replace(tzinfo=None)
+    return [(name, seconds) for name, (_, seconds) in sorted(ROLLUPS.items(), key=lambda r: -r[1][1])
+            if aligned(start, seconds) and (end >= now or aligned(end, seconds))]
+
+# Risoluzione e passo per la richiesta: il rollup più grosso il cui bucket divide il passo
+# (None = righe grezze); senza passo, quello che restituisce circa max_points bucket
+def choose_resolution(start, end, step, max_points):
+    rollups = usable_rollups(start, end)
+    if step == 'total':
+        span = (end - start).total_seconds()
+        return next((name for name, seconds in rollups if seconds <= span), None), None
+    if step is None:
+        target = max(1, -(-(end - start).total_seconds() // max_points))
+        name, seconds = next(((n, s) for n, s in rollups if s <= target), (None, 1))
+        return name, int(-(-target // seconds) * seconds)
+    return next((name for name, seconds in rollups if step % seconds == 0), None), step
+
+# Media, deviazione standard campionaria, minimo e massimo di ogni metrica:
+# dai rollup si ricompongono da conteggi, somme e somme dei quadrati
+def aggregate_columns(resolution):
+    if resolution is None:
+        columns = ['count(*) AS n']
+        for m in METRICHE:
+            columns += [f'avg({m}) AS {m}_mean', f'stddev_samp({m}) AS {m}_std',
+                        f'min({m}) AS {m}_min', f'max({m}) AS {m}_max']
+        return columns
+    columns = ['sum(n)::bigint AS n']  # sum() di bigint è numeric: tornerebbe come stringa nel JSON
+    for m in METRICHE:
+        n = f'sum(COALESCE({m}_n, n))'  # Letture con la metrica
+        columns += [f'sum({m}_sum) / NULLIF({n}, 0) AS {m}_mean',
+                    f'CASE WHEN {n} > 1 THEN sqrt(GREATEST((sum({m}_sq) - sum({m}_sum) ^ 2 / {n}) / ({n} - 1), 0)) END AS {m}_std',
+                    f'min({m}_min) AS {m}_min', f'max({m}_max) AS {m}_max']
+    return columns
+
+def build_aggregate_query(start, end, resolution, step_seconds, group_by, sensor_ids=None, zones=None):
+    table, time_column = (f'sensor_rollup_{resolution}', 'bucket') if resolution else ('sensor_data', 'timestamp')
+    conditions = [f'{time_column} >= :start', f'{time_column} < :end']
+    values = {'start': start, 'end': end}
+
+    if sensor_ids:
+        conditions.append('sensor_id = ANY(:sensor_ids)')
+        values['sensor_ids'] = sensor_ids
+    if zones:
+        conditions.append('zone = ANY(:zones)')
+        values['zones'] = zones
+
+    if step_seconds is None:
+        bucket = 'CAST(:start AS TIMESTAMPTZ)'
+    else:
+        # I bucket partono dall'inizio dell'intervallo, allineato alla risoluzione scelta
+        bucket = f'date_bin(make_interval(secs => :step), {time_column}, CAST(:start AS TIMESTAMPTZ))'
+        values['step'] = step_seconds
+
+    group_columns, select_columns = GROUP_BY[group_by]
+    group = ['1'] + group_columns
+    query = (f"SELECT {bucket} AS bucket, {', '.join(select_columns + aggregate_columns(resolution))} "
+             f"FROM {table} WHERE {' AND '.join(conditions)} "
+             f"GROUP BY {', '.join(group)} ORDER BY {', '.join(group)}")
+    return query, values
+
+# Funzione per ottenere le statistiche aggregate
+@app.get("/data/aggregate")
+async def get_data_aggregate(
+    start_date: str = Query(None, description="Data di inizio in formato 'YYYY-MM-DD'"),
+    end_date: str = Query(None, description="Data di fine in formato 'YYYY-MM-DD'"),
+    start_time: str = Query("00:00:00", description="Orario di inizio in formato 'HH:MM:SS'"),
+    end_time: str = Query("23:59:59", description="Orario di fine in formato 'HH:MM:SS'"),
+    sensor_id: str = Query(None, description="Filtro sui sensori, separati da virgola"),
+    zone: str = Query(None, description="Filtro sulle zone, separate da virgola"),
+    group_by: str = Query("zone", description="'zone', 'sensor' oppure 'all'"),
+    step: str = Query(None, description="Durata dei bucket ('15m', '1h', '7d') oppure 'total'"),
+    max_points: int = Query(500, description="Bucket per serie desiderati se step non è indicato")
+):
+    """
+    Endpoint per le statistiche (n, media, deviazione standard, minimo, massimo) per bucket di tempo.
+    Legge dal rollup più grosso compatibile con intervallo e passo (5m, 1h, 1d) e ricade
+    sulle righe grezze solo se nessun rollup è allineato.
+    """
+    try:
+        start_datetime, end_datetime = parse_range(start_date, end_date, start_time, end_time)
+        end_datetime += timedelta(seconds=1)  # Fine esclusiva: l'orario di fine è incluso al secondo
+        step_seconds = parse_step(step)
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=f"Invalid parameters: {str(e)}")
+    if group_by not in GROUP_BY:
+        raise HTTPException(status_code=400, detail="group_by must be 'zone', 'sensor' or 'all'")
+    if end_datetime <= start_datetime or max_points < 1:
+        raise HTTPException(status_code=400, detail="Invalid parameters: empty range or max_points")
+
+    resolution, step_seconds = choose_resolution(start_datetime, end_datetime, step_seconds, max_points)
+    if step_seconds and (end_datetime - start_datetime).total_seconds() / step_seconds > AGGREGATE_MAX_BUCKETS:
+        raise HTTPException(status_code=400, detail=f"Too many buckets: max {AGGREGATE_MAX_BUCKETS}")
+
+    async def fetch_aggregate():
+        query, values = build_aggregate_query(start_datetime, end_datetime, resolution, step_seconds,
+                                              group_by, split_list(sensor_id), split_list(zone))
+        rows = [dict(row) for row in await database.fetch_all(query, values=values)]
+        return {"status": "success", "resolution": resolution or "raw",
+                "step_seconds": step_seconds, "data": rows}
+
+    try:
+        params = {'sensor_id': sensor_id, 'zone': zone, 'group_by': group_by,
+                  'resolution': resolution, 'step': step_seconds}
+        return await cached_response('aggregate', params, start_datetime, end_datetime, fetch_aggregate)
+
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"Error fetching aggregates: {str(e)}")
+
+# Funzione per ottenere le anomalie rilevate
+@app.get("/anomalies")
+async def get_anomalies(
+    start_date: str = Query(None, description="Data di inizio in formato 'YYYY-MM-DD'"),
+    end_date: str = Query(None, description="Data di fine in formato 'YYYY-MM-DD'"),
+    start_time: str = Query("00:00:00", description="Orario di inizio in formato 'HH:MM:SS'"),
+    end_time: str = Query("23:59:59", description="Orario di fine in formato 'HH:MM:SS'"),
+    sensor_id: str = Query(None, description="Filtro sui sensori, separati da virgola"),
+    zone: str = Query(None, description="Filtro sulle zone, separate da virgola"),
+    metric: str = Query(None, description="Filtro sulle metriche, separate da virgola"),
+    rule: str = Query(None, description="Filtro sulle regole ('soglia', 'zscore', 'variazione')"),
+    limit: int = Query(1000, description="Anomalie massime, dalla più recente")
+):
+    """
+    Endpoint per le anomalie rilevate durante l'ingest nell'intervallo richiesto.
+    """
+    try:
+        start_datetime, end_datetime = parse_range(start_date, end_date, start_time, end_time)
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=f"Invalid parameters: {str(e)}")
+
+    conditions = ['timestamp >= :start_datetime', 'timestamp <= :end_datetime']
+    values = {'start_datetime': start_datetime, 'end_datetime': end_datetime,
+              'limit': max(1, min(limit, DATA_PAGE_MAX))}
+    for column, value in (('sensor_id', sensor_id), ('zone', zone), ('metric', metric), ('rule', rule)):
+        if split_list(value):
+            conditions.append(f'{column} = ANY(:{column})')
+            values[column] = split_list(value)
+
+    try:
+        rows = await database.fetch_all(
+            f"SELECT * FROM anomalies WHERE {' AND '.join(conditions)} ORDER BY timestamp DESC LIMIT :limit",
+            values=values)
+        return {"status": "success", "data": [dict(row) for row in rows]}
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"Error fetching anomalies: {str(e)}")
+
+# Funzione per le modifiche successive a un cursore
+@app.get("/changes")
+async def get_changes(
+    since: str = Query(None, description="cursor della risposta precedente; senza, restituisce solo il cursore attuale"),
+    limit: int = Query(100, description="Voci massime dello stream (ognuna fino a 1000 letture)")
+):
+    """
+    Endpoint per le letture (data) e le anomalie salvate dopo il cursore since, nell'ordine dei commit.
+    Con reset=true il cursore è troppo vecchio: il client deve ricaricare i dati da /data.
+    """
+    try:
+        if since is None:
+            return {"status": "success", "cursor": await changes_head(), "reset": False, "data": [], "anomalies": []}
+        stream_id(since)
+    except ValueError:
+        raise HTTPException(status_code=400, detail="Invalid parameters: since must be a cursor from /changes")
+    except redis.RedisError as e:
+        raise HTTPException(status_code=503, detail=f"Change feed unavailable: {str(e)}")
+
+    try:
+        entries, reset = await read_changes(since, max(1, min(limit, 1000)))
+    except redis.RedisError as e:
+        raise HTTPException(status_code=503, detail=f"Change feed unavailable: {str(e)}")
+
+    changes = {'readings': [], 'anomalies': []}
+    for _, fields in entries:
+        changes.setdefault(fields['type'], []).extend(json.loads(fields['data']))
+    cursor = entries[-1][0] if entries else since
+    return {"status": "success", "cursor": cursor, "reset": reset,
+            "data": changes['readings'], "anomalies": changes['anomalies']}
+
+# Funzione per ricevere le modifiche in push (Server-Sent Events)
+@app.get("/stream")
+async def stream_changes(
+    since: str = Query(None, description="Cursore da cui ripartire (in alternativa all'header Last-Event-ID)"),
+    types: str = Query("readings", description="Tipi di evento ('readings', 'anomalies'), separati da virgola"),
+    last_event_id: Optional[str] = Header(None)
+):
+    """
+    Endpoint SSE: un evento per ogni voce nuova dello stream delle modifiche (event = tipo,
+    data = array JSON di righe, id = cursore). Alla riconnessione il browser invia Last-Event-ID
+    e riceve prima le voci perse.
+    """
+    since = last_event_id or since
+    try:
+        if since:
+            stream_id(since)
+    except ValueError:
+        raise HTTPException(status_code=400, detail="Invalid parameters: since must be a cursor from /changes")
+    return StreamingResponse(sse_events(since, set(split_list(types) or [])), media_type="text/event-stream",
+                             headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"})
+
+# Funzione per lo stato corrente del vigneto
+@app.get("/state")
+async def get_state():
+    """
+    Endpoint per l'ultima lettura di ogni sensore e le statistiche per zona degli ultimi
+    ZONE_WINDOW_MINUTES minuti, letti dalla cache Redis (dal database se Redis non risponde).
+    """
+    start = time.perf_counter()
+    try:
+        sensors, zones = await state_from_cache()
+        source = "cache"
+    except redis.RedisError as e:
+        metrics.inc('cache_errors')
+        logging.warning(f"Stato letto dal database: {e}")
+        try:
+            sensors, zones, source = await latest_from_db(), {}, "database"
+        except Exception as e:
+            raise HTTPException(status_code=500, detail=f"Error fetching state: {str(e)}")
+    metrics.observe('state', time.perf_counter() - start)
+    return {"status": "success", "source": source, "window_minutes": ZONE_WINDOW_MINUTES,
+            "sensors": sensors, "zones": zones}
+
+# Funzione per le metriche (cache, ingest MQTT e stream)
+@app.get("/metrics")
+async def get_metrics():
+    """
+    Endpoint per i contatori della cache (hit, miss, errori, hit rate) e dell'ingest MQTT
+    (ricevuti, invalidi, scartati, salvati), la profondità della coda MQTT, i client di /stream
+    e le latenze p50/p99.
+    """
+    snapshot = metrics.snapshot()
+    hits, misses = metrics.counters['cache_hits'], metrics.counters['cache_misses']
+    snapshot['cache_hit_rate'] = hits / (hits + misses) if hits + misses else None
+    snapshot['mqtt_queue'] = {
+        'depth': mqtt_queue.qsize() if mqtt_queue else 0,
+        'max': MQTT_QUEUE_SIZE,
+    }
+    snapshot['stream_subscribers'] = len(broadcaster.subscribers)
+    return snapshot
+
 # Funzione per lo stato del sistema
 @app.get("/status")
 async def get_status():
@@ -238,6 +1694,8 @@ async def add_manual_measure(misura: SensorData):
     Endpoint per aggiungere una misura manuale nel sistema.
     """
     logging.debug(f"Received POST request for /add_manual_measure: {misura.dict()}")
+    if beyond_partitions(misura):
+        raise HTTPException(status_code=400, detail="Timestamp beyond partitions")
     try:
         # Valida i dati ricevuti
         if not all([misura.sensor_id, misura.zone]):
@@ -257,19 +1715,101 @@ async def receive_sensor_data(sensor_data: SensorData):
     """
     Endpoint per ricevere i dati del sensore e salvarli nel database.
     """
+    # Timestamp recente e firma valida; la chiave derivata dalla firma scarta i reinvii
+    error = check_signed_reading(sensor_data)
+    if error:
+        raise HTTPException(status_code=400, detail=error)
     try:
-        # Verifica la firma dei dati
-        if not verify_signature(sensor_data.dict()):
-            raise HTTPException(status_code=400, detail="Invalid signature")
-
         # Salva i dati nel database
-        await save_to_db(sensor_data)
+        if not await save_to_db(sensor_data):
+            return {"status": "success", "message": "Duplicate reading ignored"}
 
         return {"status": "success", "message": "Data received and saved successfully"}
 
     except Exception as e:
         raise HTTPException(status_code=500, detail=f"An error occurred: {str(e)}")
 
+# Funzione per ricevere un batch di letture (array JSON o NDJSON)
+@app.post("/data/bulk")
+async def receive_sensor_data_bulk(request: Request):
+    """
+    Endpoint per ricevere molte letture in una richiesta e salvarle in una sola transazione.
+    Le letture già viste (stessa firma, anche da /data o MQTT) vengono contate come duplicati
+    e non salvate, quindi un batch si può ripetere dopo un timeout.
+    """
+    try:
+        items = parse_bulk_body(await request.body(), request.headers.get("content-type", ""))
+    except (ValueError, UnicodeDecodeError) as e:
+        raise HTTPException(status_code=400, detail=f"Invalid bulk body: {str(e)}")
+
+    if len(items) > BULK_MAX_READINGS:
+        raise HTTPException(status_code=413, detail=f"Too many readings: max {BULK_MAX_READINGS}")
+
+    readings, rejected = validate_batch(items)
+
+    try:
+        inserted = await save_batch_to_db(readings) if readings else 0
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"An error occurred: {str(e)}")
+
+    return {
+        "status": "success",
+        "received": len(items),
+        "inserted": inserted,
+        "duplicates": len(items) - len(rejected) - inserted,
+        "rejected": rejected,
+    }
+
+# Funzione per ricevere le trame autenticate dei nodi LoRa
+@app.post("/frames")
+async def receive_frames(request: Request):
+    """
+    Endpoint per le trame inoltrate dal gateway LoRa (corpo binario, una o più trame concatenate).
+    Ogni trama porta un batch di letture di un nodo con un solo tag: si verifica il tag con la chiave
+    del nodo e si scartano le trame con un contatore già visto (replay).
+    """
+    received_at = datetime.now(timezone.utc)
+    try:
+        decoded = [frame_auth.decode_frame(f) for f in frame_auth.split_frames(await request.body())]
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=f"Invalid frames: {str(e)}")
+
+    if sum(len(f.readings) for f in decoded) > BULK_MAX_READINGS:
+        raise HTTPException(status_code=413, detail=f"Too many readings: max {BULK_MAX_READINGS}")
+
+    start = time.perf_counter()
+    frames, rejected = [], []
+    for index, frame in enumerate(decoded):
+        if frame.device_id not in nodes:
+            error = 'Unknown device'
+        elif not frame_auth.verify_frame(frame_keys, frame):
+            error = 'Invalid tag'
+        else:
+            frames.append(frame)
+            continue
+        rejected.append({'index': index, 'device_id': frame.device_id, 'counter': frame.counter, 'error': error})
+    metrics.observe('frame_verify', time.perf_counter() - start)
+
+    try:
+        accepted, replayed, inserted = await save_frames_to_db(frames, received_at) if frames else ([], [], 0)
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"An error occurred: {str(e)}")
+
+    # Posizione nel corpo per oggetto: due copie della stessa trama restano distinte
+    position = {id(frame): index for index, frame in enumerate(decoded)}
+    rejected += [{'index': position[id(f)], 'device_id': f.device_id, 'counter': f.counter, 'error': 'Replayed frame'}
+                 for f in replayed]
+    rejected.sort(key=lambda r: r['index'])
+    metrics.inc('frames_received', len(decoded))
+    metrics.inc('frames_rejected', len(rejected))
+    return {
+        "status": "success",
+        "frames": len(decoded),
+        "accepted": len(accepted),
+        "inserted": inserted,
+        "rejected": rejected,
+    }
+
 # ========== Funzione principale per eseguire l'applicazione ==========
 if __name__ == "__main__":
     import uvicorn
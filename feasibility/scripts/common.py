@@ -12,15 +12,121 @@ SOGLIE = {
     'luminosity': (0, 100000)
 }
 
-def fetch_sensor_data(backend_url):
+PAGE_SIZE = 5000  # Righe per pagina richieste a /data
+
+def fetch_sensor_data(backend_url, params=None):
+    """Scarica tutte le pagine di /data seguendo next_cursor."""
+    params = dict(params or {}, limit=PAGE_SIZE)
+    data = []
     try:
-        response = requests.get(f"{backend_url}/data", timeout=5)
+        while True:
+            response = requests.get(f"{backend_url}/data", params=params, timeout=30)
+            response.raise_for_status()
+            page = response.json()
+            data.extend(page.get("data", []))
+            if not page.get("next_cursor"):
+                return data
+            params["cursor"] = page["next_cursor"]
+    except requests.RequestException as e:
+        st.error(f"❌ Errore nel fetch dei dati: {e}")
+        return []
+
+TIMEZONE = 'Europe/Zurich'  # Fuso orario delle dashboard
+
+def fetch_changes(backend_url, since=None):
+    """Letture e anomalie salvate dopo il cursore since (/changes): (letture, anomalie, cursore, reset)."""
+    rows, anomalies = [], []
+    while True:
+        params = {'since': since} if since else {}
+        response = requests.get(f"{backend_url}/changes", params=params, timeout=30)
+        response.raise_for_status()
+        page = response.json()
+        if page.get("reset"):
+            return [], [], page["cursor"], True
+        rows.extend(page.get("data", []))
+        anomalies.extend(page.get("anomalies", []))
+        # Senza since si riceve solo il cursore; una pagina vuota chiude il recupero
+        if since is None or page["cursor"] == since:
+            return rows, anomalies, page["cursor"], False
+        since = page["cursor"]
+
+def fetch_anomalies(backend_url, params=None):
+    """Anomalie rilevate dal backend durante l'ingest (/anomalies)."""
+    try:
+        response = requests.get(f"{backend_url}/anomalies", params=dict(params or {}, limit=PAGE_SIZE), timeout=30)
         response.raise_for_status()
         return response.json().get("data", [])
     except requests.RequestException as e:
-        st.error(f"❌ Errore nel fetch dei dati: {e}")
+        st.error(f"❌ Errore nel fetch delle anomalie: {e}")
         return []
 
+def readings_to_frame(rows):
+    """Letture -> DataFrame con timestamp nel fuso delle dashboard (convertiti una sola volta)."""
+    df = pd.DataFrame(rows)
+    if not df.empty:
+        df['timestamp'] = pd.to_datetime(df['timestamp'], utc=True).dt.tz_convert(TIMEZONE)
+    return df
+
+# Chiavi che identificano una lettura e un'anomalia nel frame in cache
+FRAME_KEYS = {'frame': ['id'], 'anomalies': ['reading_id', 'metric', 'rule']}
+
+def append_in_range(frame, rows, params, keys):
+    """Aggiunge a frame le righe nuove che cadono nell'intervallo params."""
+    new = readings_to_frame(rows)
+    if new.empty:
+        return frame
+    start = pd.Timestamp(f"{params['start_date']} {params['start_time']}", tz='UTC')
+    end = pd.Timestamp(f"{params['end_date']} {params['end_time']}", tz='UTC')
+    new = new[new['timestamp'].between(start, end)]
+    if new.empty:
+        return frame
+    return pd.concat([frame, new], ignore_index=True).drop_duplicates(subset=keys, keep='last')
+
+def load_frame(backend_url, params):
+    """
+    DataFrame dell'intervallo params tenuto in session_state: al primo caricamento (o se
+    cambia l'intervallo) scarica tutto da /data, poi aggiunge solo le letture nuove da /changes.
+    Le anomalie dell'intervallo (cached_anomalies) seguono lo stesso percorso.
+    """
+    state = st.session_state
+    key = tuple(sorted(params.items()))
+    try:
+        if state.get('frame_key') == key:
+            rows, anomalies, cursor, reset = fetch_changes(backend_url, state['frame_cursor'])
+            if not reset:
+                state['frame_cursor'] = cursor
+                state['frame'] = append_in_range(state['frame'], rows, params, FRAME_KEYS['frame'])
+                state['anomalies'] = append_in_range(state['anomalies'], anomalies, params, FRAME_KEYS['anomalies'])
+                return state['frame']
+
+        # Il cursore va letto prima dei dati: ciò che arriva durante il download torna con /changes
+        _, _, cursor, _ = fetch_changes(backend_url)
+    except requests.RequestException as e:
+        st.warning(f"⚠️ Aggiornamento incrementale non disponibile: {e}")
+        cursor = None
+    state['frame'] = readings_to_frame(fetch_sensor_data(backend_url, params))
+    state['anomalies'] = readings_to_frame(fetch_anomalies(backend_url, params))
+    state['frame_key'] = key if cursor else None
+    state['frame_cursor'] = cursor
+    return state['frame']
+
+def cached_anomalies():
+    """Anomalie dell'intervallo caricato da load_frame."""
+    return st.session_state.get('anomalies', pd.DataFrame())
+
+def fetch_aggregate(backend_url, params=None):
+    """Statistiche per bucket da /data/aggregate (rollup lato backend) come DataFrame."""
+    try:
+        response = requests.get(f"{backend_url}/data/aggregate", params=params, timeout=30)
+        response.raise_for_status()
+        df = pd.DataFrame(response.json().get("data", []))
+    except requests.RequestException as e:
+        st.error(f"❌ Errore nel fetch delle aggregazioni: {e}")
+        return pd.DataFrame()
+    if 'bucket' in df.columns:
+        df['bucket'] = pd.to_datetime(df['bucket'], utc=True)
+    return df
+
 def data_to_dataframe(data):
     if not data:
         return pd.DataFrame()
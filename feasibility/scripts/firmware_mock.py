@@ -19,6 +19,7 @@ class FirmwareMock:
         self.mqtt_broker = config.get("mqtt_broker", "localhost")
         self.mqtt_port = config.get("mqtt_port", 1883)
         self.mqtt_topic = config.get("mqtt_topic", "sensor/data")
+        self.mqtt_qos = config.get("mqtt_qos", 1)  # QoS 1: il broker riconsegna finché il backend non ha salvato
 
         self.sensors_per_zone = config.get("sensors_per_zone", 2)
         self.send_interval = config.get("send_interval", 5)
@@ -27,7 +28,7 @@ class FirmwareMock:
         self.soglie = config.get("soglie", {})
 
         if self.use_mqtt:
-            self.mqtt_client = mqtt.Client()
+            self.mqtt_client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
             try:
                 self.mqtt_client.connect(self.mqtt_broker, self.mqtt_port)
                 self.mqtt_client.loop_start()
@@ -60,7 +61,7 @@ class FirmwareMock:
 
         if self.use_mqtt:
             payload = json.dumps(data)
-            self.mqtt_client.publish(self.mqtt_topic, payload)
+            self.mqtt_client.publish(self.mqtt_topic, payload, qos=self.mqtt_qos)
         else:
             requests.post(self.backend_url, json=data)
 
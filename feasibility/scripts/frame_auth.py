@@ -0,0 +1,224 @@
+import os
+import hmac
+import time
+import random
+import struct
+import hashlib
+import argparse
+from datetime import datetime, timezone
+from typing import NamedTuple, List, Optional
+
+# Autenticazione delle letture, condivisa da backend, mock e generatore di carico.
+#
+# Ogni dispositivo ha una chiave propria derivata da una chiave master (FRAME_MASTER_KEY), così il
+# backend non deve conservare una tabella di segreti e un nodo compromesso non rivela le altre chiavi.
+# I nodi LoRa firmano un'intera trama (un batch di letture) con un solo tag troncato, i client JSON
+# (HTTP/MQTT) firmano ogni lettura.
+
+# Trama di uplink autenticata, stesso formato di zephyr-feasibility/src/frame_auth.c (little-endian):
+#   intestazione: tipo 0xFD, versione, device id (u32), contatore (u32), numero di letture (u8)
+#   per lettura:  temperatura (i16, decimi di °C), umidità aria (u16, decimi di %),
+#                 umidità suolo (u16, decimi di %, 0xFFFF = non misurata), luminosità (u32, decimi di lux),
+#                 età (u16, secondi prima dell'invio)
+#   tag:          primi TAG_LEN byte di HMAC-SHA256(chiave del dispositivo, intestazione + letture)
+FRAME_TYPE = 0xFD
+FRAME_VERSION = 1
+HEADER = struct.Struct("<BBIIB")
+RECORD = struct.Struct("<hHHIH")
+TAG_LEN = 4           # Come il MIC di LoRaWAN: 32 bit bastano con il contatore anti-replay
+READING_TAG_LEN = 16  # Le letture JSON non pagano airtime: tag più lungo
+SOIL_NONE = 0xFFFF
+
+METRICHE = ['temperature', 'humidity_air', 'humidity_soil', 'luminosity']
+
+# Chiave di sviluppo, la stessa del Makefile e di prj.conf del firmware. È pubblica: chiunque abbia il
+# repository firmerebbe letture valide, quindi si usa solo con FRAME_AUTH_DEV=1
+DEV_MASTER_KEY = "e8b938bb8d4fe673c890f12db7efa5578651ea5c36302cc70f09c3fd8ca1bab1"
+
+def master_key() -> bytes:
+    key = os.getenv("FRAME_MASTER_KEY")
+    if key:
+        return bytes.fromhex(key)
+    if os.getenv("FRAME_AUTH_DEV") == "1":
+        return bytes.fromhex(DEV_MASTER_KEY)
+    raise RuntimeError("FRAME_MASTER_KEY non impostata (FRAME_AUTH_DEV=1 per la chiave di sviluppo)")
+
+# Chiave di un dispositivo: "node:<id>" per i nodi LoRa, "sensor:<sensor_id>" per i client JSON
+def derive_key(master: bytes, identity: str) -> bytes:
+    return hmac.new(master, b"vitimonitor:" + identity.encode(), hashlib.sha256).digest()
+
+def node_identity(device_id: int) -> str:
+    return f"node:{device_id}"
+
+def sensor_identity(sensor_id: str) -> str:
+    return f"sensor:{sensor_id}"
+
+# ========== Chiavi in cache ==========
+# Un oggetto HMAC per dispositivo, già inizializzato con la chiave: copy() riparte dallo stato dopo
+# ipad/opad, quindi ogni tag costa solo i blocchi del messaggio (niente derivazione né preparazione
+# della chiave per lettura)
+class KeyCache:
+    def __init__(self, master: Optional[bytes] = None):
+        self.master = master if master is not None else master_key()
+        self.states = {}
+
+    def state(self, identity):
+        h = self.states.get(identity)
+        if h is None:
+            h = self.states[identity] = hmac.new(derive_key(self.master, identity), digestmod=hashlib.sha256)
+        return h
+
+    def tag(self, identity, message, length=TAG_LEN):
+        h = self.state(identity).copy()
+        h.update(message)
+        return h.digest()[:length]
+
+    def verify(self, identity, message, tag):
+        return hmac.compare_digest(self.tag(identity, message, len(tag)), tag)
+
+# ========== Letture JSON ==========
+# Forma canonica della lettura firmata: non dipende da come il client ha serializzato il JSON.
+# Il timestamp è obbligatorio: senza, due letture uguali avrebbero la stessa firma e il backend
+# non potrebbe rifiutare quelle vecchie ripresentate
+def reading_message(data: dict) -> bytes:
+    ts = data.get('timestamp')
+    if not ts:
+        raise ValueError("Signed readings need a timestamp")
+    if isinstance(ts, str):
+        ts = datetime.fromisoformat(ts)
+    fields = [data['sensor_id'], data['zone'], ts.isoformat()]
+    fields += ['' if data.get(m) is None else repr(float(data[m])) for m in METRICHE]
+    fields.append('1' if data.get('manual') else '0')
+    return "|".join(fields).encode()
+
+def sign_reading(keys: KeyCache, data: dict) -> str:
+    return keys.tag(sensor_identity(data['sensor_id']), reading_message(data), READING_TAG_LEN).hex()
+
+def verify_reading(keys: KeyCache, data: dict) -> bool:
+    try:
+        tag = bytes.fromhex(data.get('signature') or '')
+        message = reading_message(data)
+    except (ValueError, KeyError, TypeError):
+        return False
+    return len(tag) == READING_TAG_LEN and keys.verify(sensor_identity(data['sensor_id']), message, tag)
+
+# ========== Trame autenticate ==========
+class Frame(NamedTuple):
+    device_id: int
+    counter: int
+    readings: List[dict]  # metriche e 'age' (s) di ogni lettura
+    message: bytes        # byte coperti dal tag
+    tag: bytes
+
+def frame_length(count: int) -> int:
+    return HEADER.size + count * RECORD.size + TAG_LEN
+
+def encode_frame(keys: KeyCache, device_id: int, counter: int, readings: List[dict]) -> bytes:
+    parts = [HEADER.pack(FRAME_TYPE, FRAME_VERSION, device_id, counter, len(readings))]
+    for r in readings:
+        soil = SOIL_NONE if r.get('humidity_soil') is None else round(r['humidity_soil'] * 10)
+        parts.append(RECORD.pack(round(r['temperature'] * 10), round(r['humidity_air'] * 10), soil,
+                                 round(r['luminosity'] * 10), r.get('age', 0)))
+    message = b"".join(parts)
+    return message + keys.tag(node_identity(device_id), message)
+
+# Divide un corpo con più trame concatenate (la lunghezza di ognuna è nell'intestazione)
+def split_frames(body: bytes) -> List[bytes]:
+    frames, offset = [], 0
+    while offset < len(body):
+        if len(body) - offset < HEADER.size:
+            raise ValueError(f"Truncated frame header at byte {offset}")
+        kind, version, _, _, count = HEADER.unpack_from(body, offset)
+        if kind != FRAME_TYPE or version != FRAME_VERSION:
+            raise ValueError(f"Unknown frame type {kind:#04x} v{version} at byte {offset}")
+        end = offset + frame_length(count)
+        if end > len(body):
+            raise ValueError(f"Truncated frame at byte {offset}")
+        frames.append(body[offset:end])
+        offset = end
+    return frames
+
+def decode_frame(frame: bytes) -> Frame:
+    _, _, device_id, counter, count = HEADER.unpack_from(frame)
+    readings = []
+    for i in range(count):
+        temp, hum, soil, lux, age = RECORD.unpack_from(frame, HEADER.size + i * RECORD.size)
+        readings.append({
+            'temperature': temp / 10,
+            'humidity_air': hum / 10,
+            'humidity_soil': None if soil == SOIL_NONE else soil / 10,
+            'luminosity': lux / 10,
+            'age': age,
+        })
+    return Frame(device_id, counter, readings, frame[:-TAG_LEN], frame[-TAG_LEN:])
+
+def verify_frame(keys: KeyCache, frame: Frame) -> bool:
+    return keys.verify(node_identity(frame.device_id), frame.message, frame.tag)
+
+# ========== Benchmark ==========
+def sample_reading(sensor_id):
+    return {
+        'sensor_id': sensor_id, 'zone': 'zone_north', 'manual': False,
+        'temperature': round(random.uniform(10, 30), 1), 'humidity_air': round(random.uniform(40, 60), 1),
+        'humidity_soil': round(random.uniform(25, 35), 1), 'luminosity': round(random.uniform(0, 50000), 1),
+        'timestamp': datetime.now(timezone.utc).isoformat(),
+    }
+
+def timed(fn, items):
+    start = time.perf_counter()
+    ok = sum(1 for item in items if fn(item))
+    return time.perf_counter() - start, ok
+
+# Costo di verifica per lettura: firma per lettura (con e senza chiavi in cache) e trame a batch,
+# più i byte in aria per lettura rispetto al payload testuale del firmware
+def bench(args):
+    keys = KeyCache()
+    readings = [sample_reading(f"sensor_{i % args.devices}") for i in range(args.readings)]
+    for r in readings:
+        r['signature'] = sign_reading(keys, r)
+
+    print(f"▶ {args.readings} letture, {args.devices} dispositivi")
+    print(f"{'verifica':<28} {'µs/lettura':>10} {'byte/lettura':>13}")
+
+    cold = KeyCache(keys.master)
+    elapsed, ok = timed(lambda r: (cold.states.clear(), verify_reading(cold, r))[1], readings)
+    print(f"{'lettura, chiave derivata':<28} {1e6 * elapsed / len(readings):>10.2f} {'-':>13}")
+
+    keys.states.clear()
+    timed(lambda r: verify_reading(keys, r), readings[:args.devices])  # chiavi in cache
+    elapsed, ok = timed(lambda r: verify_reading(keys, r), readings)
+    assert ok == len(readings)
+    print(f"{'lettura, chiave in cache':<28} {1e6 * elapsed / len(readings):>10.2f} {'-':>13}")
+
+    text = len(f"T:{21.4} H:{55.0} L:{31000.5}")
+    print(f"{'(payload testuale)':<28} {'-':>10} {text:>13.1f}")
+    for batch in args.batch:
+        frames = []
+        for start in range(0, len(readings), batch):
+            device = (start // batch) % args.devices
+            frames.append(encode_frame(keys, device, start, readings[start:start + batch]))
+        for device in range(args.devices):
+            keys.state(node_identity(device))
+        elapsed, ok = timed(lambda f: verify_frame(keys, decode_frame(f)), frames)
+        assert ok == len(frames)
+        per_reading = sum(len(f) for f in frames) / len(readings)
+        print(f"{f'trama da {batch} letture':<28} {1e6 * elapsed / len(readings):>10.2f} {per_reading:>13.1f}")
+
+def main():
+    parser = argparse.ArgumentParser(description="Chiavi dei dispositivi e benchmark della verifica")
+    commands = parser.add_subparsers(dest="command", required=True)
+    key = commands.add_parser("key", help="Chiave di un nodo, da mettere in CONFIG_APP_FRAME_AUTH_KEY")
+    key.add_argument("--device", type=int, required=True, help="Device id del nodo")
+    b = commands.add_parser("bench", help="Costo della verifica per lettura")
+    b.add_argument("--readings", type=int, default=100000, help="Letture verificate")
+    b.add_argument("--devices", type=int, default=10000, help="Dispositivi (chiavi) distinti")
+    b.add_argument("--batch", type=int, nargs="+", default=[1, 4, 8, 16], help="Letture per trama")
+    args = parser.parse_args()
+
+    if args.command == "key":
+        print(derive_key(master_key(), node_identity(args.device)).hex())
+    else:
+        bench(args)
+
+if __name__ == "__main__":
+    main()
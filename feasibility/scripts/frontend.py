@@ -1,12 +1,12 @@
 import pandas as pd
 from datetime import datetime, time
 import streamlit as st
-from common import METRICHE, fetch_sensor_data, data_to_dataframe
+from streamlit_autorefresh import st_autorefresh
+from common import METRICHE, load_frame
 import frontend_manager as fm
 import frontend_enologo as fe
 import frontend_operatore as fo
 import frontend_log as fl
-import requests
 
 
 # --- CONFIG APP ---
@@ -35,6 +35,10 @@ st.sidebar.title("🔄 Aggiornamento dati")
 if st.sidebar.button("📥 Aggiorna manualmente", key="manual_refresh"):
     st.rerun()
 
+# Ogni aggiornamento scarica solo le letture nuove: si può tenere attivo anche su intervalli lunghi
+if st.sidebar.toggle("⏱️ Aggiornamento automatico (10 s)", value=True, key="auto_refresh"):
+    st_autorefresh(interval=10000, key="auto_refresh_timer")
+
 # Filtro intervallo dati in frontend.py (sidebar)
 st.sidebar.markdown("---")
 st.sidebar.title("📈 Intervallo dati")
@@ -73,31 +77,23 @@ end_date = date_range[1].strftime('%Y-%m-%d')
 start_time_str = start_time.strftime('%H:%M:%S')
 end_time_str = end_time.strftime('%H:%M:%S')
 
-# Costruisci la URL dell'endpoint e invia la richiesta GET
-url = f"http://localhost:8000/data?start_date={start_date}&end_date={end_date}&start_time={start_time_str}&end_time={end_time_str}"
-
-# Fai una richiesta GET al backend
-response = requests.get(url)
-
-# Gestisci la risposta
-if response.status_code == 200:
-    data = response.json()['data']
-    df = pd.DataFrame(data)
-    if df.empty:
-        st.warning("Nessun dato ricevuto dal backend.")
-        st.stop()
-else:
-    st.error(f"Errore nel recupero dei dati: {response.status_code}")
-    st.stop()
+# Intervallo in cache nella sessione: scaricato una volta, poi solo le letture nuove (timestamp già in CEST)
+df = load_frame(backend_url, {
+    'start_date': start_date,
+    'end_date': end_date,
+    'start_time': start_time_str,
+    'end_time': end_time_str,
+})
 
-df['timestamp'] = pd.to_datetime(df['timestamp'], utc=True)  # Converte in datetime UTC
-df['timestamp'] = df['timestamp'].dt.tz_convert('Europe/Zurich')  # Converti in CEST
+if df.empty:
+    st.warning("Nessun dato ricevuto dal backend.")
+    st.stop()
 
 # --- TABS FRONTEND ---
 tabs = st.tabs(["👨‍💼 Manager", "🍷 Enologo", "👷 Operatore", "📝 Log"])
 
 with tabs[0]:
-    fm.render(df)
+    fm.render(df, backend_url)
 
 with tabs[1]:
     fe.render(df)
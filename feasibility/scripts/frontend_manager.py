@@ -1,24 +1,23 @@
 import streamlit as st
 import pandas as pd
 import plotly.express as px
-from common import check_thresholds
+from common import cached_anomalies, fetch_aggregate
 import pandas as pd
 
-def render(df):
+def render(df, backend_url):
     st.header("👨‍💼 Manager")
-    
-    # Verifica che 'timestamp' sia in formato datetime, altrimenti convertilo
-    df['timestamp'] = pd.to_datetime(df['timestamp'], errors='coerce')
-    
-    # Ora puoi utilizzare .dt senza problemi
-    df['timestamp'] = df['timestamp'].dt.tz_localize(None)  # Rimuove eventuali informazioni sul fuso orario
 
-    last_week = pd.Timestamp.today() - pd.Timedelta(days=7)
-    last_week = last_week.tz_localize(None)  # Rimuove timezone info se esiste
-
-    # Filtering the data for the last week
-    df['date'] = df['timestamp'].dt.date
-    df_week = df[df['timestamp'] >= last_week]
+    # Ultimi 7 giorni (oggi incluso): le statistiche arrivano già aggregate dai rollup del backend
+    today = pd.Timestamp.today()
+    week = {
+        'start_date': (today - pd.Timedelta(days=6)).strftime('%Y-%m-%d'),
+        'end_date': today.strftime('%Y-%m-%d'),
+    }
+    df_week = fetch_aggregate(backend_url, {**week, 'group_by': 'all', 'step': 'total'})
+    if df_week.empty:
+        st.warning("Nessun dato nell'ultima settimana.")
+        return
+    week_stats = df_week.iloc[0]
 
     # La parte successiva del codice rimane invariata
     st.subheader("💰 Parametri Economici")
@@ -31,11 +30,11 @@ def render(df):
         kg_uva_perduta = st.number_input("Kg di uva persa per zona a rischio", value=500, step=50)
 
     # 🔷 Creazione del DataFrame per le zone
-    df_zone = df_week.groupby('zone').agg({
-        'temperature': ['mean', 'std'],
-        'humidity_air': ['mean', 'std'],
-        'humidity_soil': ['mean', 'std']
-    }).reset_index()
+    df_zone = fetch_aggregate(backend_url, {**week, 'group_by': 'zone', 'step': 'total'})
+    df_zone = df_zone[[
+        'zone', 'temperature_mean', 'temperature_std', 'humidity_air_mean', 'humidity_air_std',
+        'humidity_soil_mean', 'humidity_soil_std'
+    ]]
     df_zone.columns = [
         'zone', 'temp_mean', 'temp_std', 'hum_air_mean', 'hum_air_std', 'hum_soil_mean', 'hum_soil_std'
     ]
@@ -44,7 +43,8 @@ def render(df):
     # 🔷 Zone critiche
     zone_critiche = df_zone[df_zone['rischio'] > 2.0]
     # 🔷 Calcoli economici
-    produzione_stimata = produzione_base_kg * (1 - df_week['temperature'].std() / 10)
+    temp_std = week_stats['temperature_std'] if pd.notna(week_stats['temperature_std']) else 0
+    produzione_stimata = produzione_base_kg * (1 - temp_std / 10)
     ricavi = produzione_stimata * prezzo_kg
     # Calcolo della penalità in euro
     penalita_euro_per_zona = kg_uva_perduta * prezzo_kg
@@ -65,18 +65,17 @@ def render(df):
     # 🔷 Indicatore Chiave di Prestazione misurazioni
     st.subheader("📊 Indicatore Chiave di Prestazione settimanali — Misurazioni")
     kpi_mis_cols = st.columns(5)
-    kpi_mis_cols[0].metric("🌡️ Temp media (7gg)", f"{df_week['temperature'].mean():.1f}°C")
-    kpi_mis_cols[1].metric("💧 Umidità aria media (7gg)", f"{df_week['humidity_air'].mean():.1f}%")
-    kpi_mis_cols[2].metric("🌱 Umidità suolo media (7gg)", f"{df_week['humidity_soil'].mean():.1f}%")
+    kpi_mis_cols[0].metric("🌡️ Temp media (7gg)", f"{week_stats['temperature_mean']:.1f}°C")
+    kpi_mis_cols[1].metric("💧 Umidità aria media (7gg)", f"{week_stats['humidity_air_mean']:.1f}%")
+    kpi_mis_cols[2].metric("🌱 Umidità suolo media (7gg)", f"{week_stats['humidity_soil_mean']:.1f}%")
     kpi_mis_cols[3].metric("📈 Sensori attivi", f"{df['sensor_id'].nunique()}")
-    kpi_mis_cols[4].metric("🚨 Anomalie", len(pd.concat(
-        [check_thresholds(df, m) for m in ['temperature', 'humidity_air', 'humidity_soil', 'luminosity']]
-    )))
+    kpi_mis_cols[4].metric("🚨 Anomalie", len(cached_anomalies()))  # Rilevate dal backend durante l'ingest
 
     st.markdown("---")
 
-    # 🔷 Distribuzione
+    # 🔷 Distribuzione delle medie orarie per sensore (migliaia di punti invece delle letture grezze)
     st.subheader("📊 Distribuzione misurazioni")
+    df_hourly = fetch_aggregate(backend_url, {**week, 'group_by': 'sensor', 'step': '1h'})
 
     for metric, label in [
         ('temperature', 'Temperatura (°C)'),
@@ -86,9 +85,9 @@ def render(df):
         st.markdown(f"### {label}")
 
         fig = px.violin(
-            df_week,
+            df_hourly,
             y='zone',
-            x=metric,
+            x=f'{metric}_mean',
             color='zone',
             box=True,
             points='all',
@@ -4,7 +4,7 @@ import pandas as pd
 import streamlit as st
 import requests
 from fpdf import FPDF
-from common import check_thresholds
+from common import cached_anomalies
 import time
 
 def render(df, backend_url):
@@ -14,12 +14,10 @@ def render(df, backend_url):
     if 'resolved_anomalies' not in st.session_state:
         st.session_state['resolved_anomalies'] = []
 
-    # --- Calcola anomalie ---
-    # Genera le anomalie per ogni metrica
-    df_anomalie = pd.concat([
-        check_thresholds(df, m)
-        for m in ['temperature', 'humidity_air', 'humidity_soil', 'luminosity']
-    ])
+    # --- Anomalie rilevate dal backend durante l'ingest ---
+    # Una riga per lettura anomala (una lettura può violare più regole)
+    anomalie = cached_anomalies()
+    df_anomalie = df[df['id'].isin(anomalie['reading_id'])] if not anomalie.empty else df.iloc[0:0]
 
     # --- Filtra solo le anomalie che non sono ancora risolte ---
     df_anomalie_filtrate = df_anomalie[~df_anomalie['sensor_id'].isin(st.session_state['resolved_anomalies'])]
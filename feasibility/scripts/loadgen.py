@@ -0,0 +1,501 @@
+import os
+import sys
+import json
+import math
+import time
+import random
+import struct
+import asyncio
+import argparse
+import threading
+import multiprocessing
+import yaml
+import httpx
+import paho.mqtt.client as mqtt
+import frame_auth
+from sensor_mock import SensorMock
+
+# Generatore di carico per il backend (HTTP/MQTT) e per il gateway LoRa (UDP verso lora_channel.py).
+# Il carico è a ciclo aperto: gli invii partono a intervalli fissi indipendentemente dalle risposte,
+# e la latenza si misura dall'istante in cui l'invio era pianificato (niente "coordinated omission":
+# se il backend rallenta, le code si vedono nei percentili invece di abbassare il ritmo).
+
+LORA_UTILS = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'zephyr-feasibility', 'utils')
+LORA_FREQS = [868100000, 868300000, 868500000, 867100000, 867300000, 867500000, 867700000, 867900000]
+TICK = 0.005  # granularità dello scheduler (s)
+LORA_MAX_PAYLOAD = 255
+LORA_MAX_BATCH = (LORA_MAX_PAYLOAD - frame_auth.frame_length(0)) // frame_auth.RECORD.size
+
+# ========== Istogramma delle latenze ==========
+# Bucket logaritmici con passo ~2%: memoria costante e somma banale tra processi
+class LatencyHistogram:
+    STEP = math.log(1.02)
+
+    def __init__(self, counts=None):
+        self.counts = dict(counts or {})
+        self.total = sum(self.counts.values())
+        self.max = 0.0
+
+    def record(self, seconds):
+        us = max(seconds * 1e6, 1.0)
+        index = int(math.log(us) / self.STEP)
+        self.counts[index] = self.counts.get(index, 0) + 1
+        self.total += 1
+        self.max = max(self.max, seconds)
+
+    def merge(self, other):
+        for index, count in other.counts.items():
+            self.counts[index] = self.counts.get(index, 0) + count
+        self.total += other.total
+        self.max = max(self.max, other.max)
+
+    # Valore (s) sotto cui cade la frazione q delle misure
+    def percentile(self, q):
+        if not self.total:
+            return 0.0
+        target = q * self.total
+        seen = 0
+        for index in sorted(self.counts):
+            seen += self.counts[index]
+            if seen >= target:
+                return min(math.exp((index + 1) * self.STEP) / 1e6, self.max)
+        return self.max
+
+    # Conteggi per fasce di potenze di 2 in ms, per la stampa finale
+    def bands(self):
+        out = {}
+        for index, count in self.counts.items():
+            ms = math.exp(index * self.STEP) / 1000
+            band = 2 ** max(math.ceil(math.log2(ms)), 0) if ms > 0 else 1
+            out[band] = out.get(band, 0) + count
+        return sorted(out.items())
+
+# ========== Generazione delle letture ==========
+# Crea una lettura completa per un sensore simulato
+def make_reading(sensor):
+    data = {
+        'sensor_id': sensor.sensor_id,
+        'zone': sensor.zone,
+        'temperature': sensor.read_temperature(),
+        'humidity_air': sensor.read_humidity_air(),
+        'humidity_soil': sensor.read_humidity_soil(),
+        'luminosity': sensor.read_luminosity(),
+        'manual': False,
+        'timestamp': sensor.timestamp(),
+    }
+    data['signature'] = sensor.sign_data(data)
+    return data
+
+# Stessa trama del firmware (src/frame_auth.c): le letture accumulate da un nodo, la più vecchia per prima
+def lora_frame(keys, device_id, counter, readings, interval):
+    records = [dict(r, age=min(round((len(readings) - 1 - i) * interval), 0xFFFF))
+               for i, r in enumerate(readings)]
+    return frame_auth.encode_frame(keys, device_id, counter, records)
+
+# ========== Trasporti ==========
+# Ogni trasporto espone send(readings) -> letture salvate; solleva un'eccezione in caso di errore
+class HttpSender:
+    def __init__(self, args):
+        self.url = args.url.rstrip('/')
+        self.mode = args.mode
+        self.client = httpx.AsyncClient(timeout=args.timeout,
+                                        limits=httpx.Limits(max_connections=args.concurrency))
+
+    async def send(self, readings):
+        if self.mode == "single":
+            response = await self.client.post(f"{self.url}/data", json=readings[0])
+            response.raise_for_status()
+            return 1
+
+        headers = {}  # I reinvii si riconoscono dalla firma delle letture
+        if self.mode == "ndjson":
+            headers['Content-Type'] = 'application/x-ndjson'
+            body = "\n".join(json.dumps(r) for r in readings)
+        else:
+            headers['Content-Type'] = 'application/json'
+            body = json.dumps(readings)
+        response = await self.client.post(f"{self.url}/data/bulk", content=body, headers=headers)
+        response.raise_for_status()
+        return response.json()['inserted']
+
+    async def close(self):
+        await self.client.aclose()
+
+# MQTT: il PUBACK arriva dal broker, non dal backend, e misurerebbe solo la pubblicazione. La lettura
+# è confermata quando la sua firma (da cui il backend deriva la chiave di idempotenza) compare nel
+# flusso delle modifiche di /stream, cioè dopo il commit: la latenza è quella di ingest
+class MqttSender:
+    def __init__(self, args, worker):
+        self.url = args.url.rstrip('/')
+        self.topic = args.topic
+        self.qos = args.qos
+        self.timeout = args.timeout
+        self.loop = asyncio.get_running_loop()
+        self.lock = threading.Lock()
+        self.pending = {}
+        self.early = {}  # PUBACK arrivati prima che publish() restituisse il mid
+        self.ingested = {}  # firma -> future risolta quando la lettura compare in /stream
+        self.http = httpx.AsyncClient(timeout=httpx.Timeout(args.timeout, read=None))
+        self.watcher = None
+
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2,
+                                  client_id=f"loadgen-{os.getpid()}-{worker}")
+        self.client.max_inflight_messages_set(args.concurrency)
+        self.client.on_publish = self.on_publish
+        self.client.connect(args.broker, args.mqtt_port)
+        self.client.loop_start()
+
+    async def open(self):
+        # Il cursore attuale fa ripartire /stream da qui: nessun commit cade tra apertura e primo invio
+        response = await self.http.get(f"{self.url}/changes")
+        response.raise_for_status()
+        self.watcher = asyncio.create_task(self.watch(response.json()['cursor']))
+        return self
+
+    async def watch(self, cursor):
+        try:
+            async with self.http.stream("GET", f"{self.url}/stream",
+                                        params={'since': cursor, 'types': 'readings'}) as response:
+                response.raise_for_status()
+                error = RuntimeError("/stream chiuso dal backend")
+                async for line in response.aiter_lines():
+                    if line == "event: reset":
+                        error = RuntimeError("reset, letture in attesa perse")  # Il flusso non è più completo
+                        break
+                    if not line.startswith("data: "):
+                        continue
+                    rows = json.loads(line[len("data: "):])
+                    for row in rows if isinstance(rows, list) else []:
+                        future = self.ingested.pop(row.get('signature'), None)
+                        if future is not None and not future.done():
+                            future.set_result(None)
+        except httpx.HTTPError as e:
+            error = e
+        # Senza flusso nessuna lettura in attesa può più essere confermata
+        for future in self.ingested.values():
+            if not future.done():
+                future.set_exception(RuntimeError(f"/stream: {error}"))
+        self.ingested.clear()
+
+    def on_publish(self, client, userdata, mid, reason_code, properties):
+        with self.lock:
+            future = self.pending.pop(mid, None)
+            if future is None:
+                self.early[mid] = reason_code
+                return
+        self.loop.call_soon_threadsafe(self.resolve, future, reason_code)
+
+    @staticmethod
+    def resolve(future, reason_code):
+        if not future.done():
+            future.set_result(reason_code)
+
+    async def send(self, readings):
+        if self.watcher.done():
+            raise RuntimeError("/stream non disponibile")
+        signature = readings[0]['signature']
+        ingested = self.ingested[signature] = self.loop.create_future()  # Prima del publish: il commit può precederne il ritorno
+        try:
+            info = self.client.publish(self.topic, json.dumps(readings[0]), qos=self.qos)
+            if info.rc != mqtt.MQTT_ERR_SUCCESS:
+                raise RuntimeError(mqtt.error_string(info.rc))
+            future = self.loop.create_future()
+            with self.lock:
+                if info.mid in self.early:
+                    future.set_result(self.early.pop(info.mid))
+                else:
+                    self.pending[info.mid] = future
+            reason_code = await future
+            if getattr(reason_code, 'is_failure', False):
+                raise RuntimeError(f"PUBACK {reason_code}")
+            await asyncio.wait_for(ingested, self.timeout)
+        finally:
+            self.ingested.pop(signature, None)
+        return 1
+
+    async def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+        self.watcher.cancel()
+        await self.http.aclose()
+
+# UDP: trame LoRa con l'intestazione del broker di canale (zephyr-feasibility/utils/lora_channel.py).
+# Il verdetto arriva a fine time-on-air: consegnata, oppure persa per collisione/segnale debole.
+class LoraLost(Exception):
+    pass
+
+class UdpSender(asyncio.DatagramProtocol):
+    def __init__(self, args, worker):
+        sys.path.insert(0, LORA_UTILS)
+        import lora_channel
+        self.lc = lora_channel
+        self.addr = (args.gateway, args.gateway_port)
+        self.devices = {sensor_id: device for device, sensor_id, _ in args.devices}
+        self.keys = frame_auth.KeyCache()
+        self.interval = args.interval
+        # Il backend accetta solo contatori crescenti per nodo: si parte dall'orario, sopra quelli
+        # delle esecuzioni precedenti (ogni nodo appartiene a un solo processo)
+        self.counters = {}
+        self.counter_start = args.counter_start
+        self.seq = 0
+        self.pending = {}
+        self.radio = {}  # parametri radio fissi per sensore (SF, canale, RSSI)
+        self.rng = random.Random(worker)
+        self.transport = None
+
+    async def open(self):
+        loop = asyncio.get_running_loop()
+        self.transport, _ = await loop.create_datagram_endpoint(lambda: self, remote_addr=self.addr)
+        return self
+
+    def datagram_received(self, data, addr):
+        if len(data) < struct.calcsize(self.lc.VERDICT_FMT):
+            return
+        magic, seq, delivered, reason = struct.unpack_from(self.lc.VERDICT_FMT, data)
+        future = self.pending.pop(seq, None)
+        if magic == self.lc.VERDICT_MAGIC and future and not future.done():
+            future.set_result((delivered, reason))
+
+    async def send(self, readings):
+        reading = readings[0]
+        sf, freq, rssi, snr = self.radio.setdefault(reading['sensor_id'], (
+            self.rng.choice([7, 7, 7, 8, 8, 9, 10, 11, 12]), self.rng.choice(LORA_FREQS),
+            self.rng.uniform(-120, -80), self.rng.uniform(-10, 10)))
+        device = self.devices[reading['sensor_id']]
+        counter = self.counters[device] = self.counters.get(device, self.counter_start) + 1
+        payload = lora_frame(self.keys, device, counter & 0xFFFFFFFF, readings, self.interval)
+        toa_us = self.lc.time_on_air_us(sf, 125000, len(payload))
+
+        self.seq = (self.seq + 1) & 0xFFFF
+        seq = self.seq
+        header = struct.pack(self.lc.HDR_FMT, self.lc.HDR_MAGIC, seq, sf, 1, freq, 125000,
+                             toa_us, int(rssi * 10), int(snr * 10))
+        future = asyncio.get_running_loop().create_future()
+        self.pending[seq] = future
+        self.transport.sendto(header + payload)
+        try:
+            delivered, reason = await future
+        finally:
+            self.pending.pop(seq, None)
+        if not delivered:
+            raise LoraLost(self.lc.REASONS.get(reason, reason))
+        return len(readings)
+
+    async def close(self):
+        self.transport.close()
+
+async def open_sender(args, worker):
+    if args.transport == "mqtt":
+        return await MqttSender(args, worker).open()
+    if args.transport == "udp":
+        return await UdpSender(args, worker).open()
+    return HttpSender(args)
+
+# ========== Processo di carico ==========
+def new_stats():
+    return {'sent': 0, 'readings': 0, 'saved': 0, 'errors': 0, 'lost': 0, 'skipped': 0,
+            'timeouts': 0, 'last_error': None, 'hist': LatencyHistogram()}
+
+async def timed_send(sender, readings, scheduled, stats, loop):
+    try:
+        saved = await sender.send(readings)  # prima l'attesa: += su stats leggerebbe un valore vecchio
+        stats['saved'] += saved
+    except LoraLost:
+        stats['lost'] += 1
+    except Exception as e:  # noqa: BLE001 - qualunque errore del trasporto conta come fallimento
+        stats['errors'] += 1
+        stats['last_error'] = f"{type(e).__name__}: {e}"
+    finally:
+        stats['hist'].record(loop.time() - scheduled)
+
+async def run_worker(worker, args):
+    # I sensori sono ripartiti tra i processi: il processo k simula i sensori k, k+P, k+2P...
+    if args.transport == "udp":
+        sensors = [SensorMock(sensor_id=sensor_id, zone=zone) for _, sensor_id, zone in args.devices]
+    else:
+        sensors = [SensorMock(sensor_id=f"{zone}_sensor_{i}", zone=zone)
+                   for i in range(1, args.sensors // len(args.zones) + 1)
+                   for zone in args.zones]
+    sensors = sensors[worker::args.processes]
+    per_send = 1 if args.transport == "mqtt" or (args.transport == "http" and args.mode == "single") else args.batch
+    rate = args.rate / args.processes / per_send  # invii/s di questo processo
+    stats = new_stats()
+    if not sensors or rate <= 0:
+        return stats
+
+    loop = asyncio.get_running_loop()
+    sender = await open_sender(args, worker)
+    tasks = set()
+    cursor = 0
+    scheduled_count = 0
+    start = loop.time()
+    deadline = start + args.duration
+
+    while loop.time() < deadline:
+        # Tutti gli invii già scaduti partono subito, ciascuno con il proprio istante pianificato
+        due = int((loop.time() - start) * rate) - scheduled_count
+        for _ in range(due):
+            scheduled = start + scheduled_count / rate
+            scheduled_count += 1
+            if len(tasks) >= args.concurrency:
+                stats['skipped'] += 1  # client saturo: il backend non regge il ritmo richiesto
+                continue
+            if args.transport == "udp":  # Una trama LoRa porta le letture accumulate da un solo nodo
+                readings = [make_reading(sensors[cursor]) for _ in range(per_send)]
+                cursor = (cursor + 1) % len(sensors)
+            else:
+                readings = []
+                for _ in range(per_send):
+                    readings.append(make_reading(sensors[cursor]))
+                    cursor = (cursor + 1) % len(sensors)
+            stats['sent'] += 1
+            stats['readings'] += len(readings)
+            task = loop.create_task(timed_send(sender, readings, scheduled, stats, loop))
+            tasks.add(task)
+            task.add_done_callback(tasks.discard)
+        await asyncio.sleep(TICK)
+
+    if tasks:
+        _, late = await asyncio.wait(tasks, timeout=args.timeout)
+        for task in late:
+            task.cancel()
+        stats['timeouts'] = len(late)
+        stats['errors'] += len(late)
+    await sender.close()
+    stats['elapsed'] = loop.time() - start
+    return stats
+
+def process_main(worker, args):
+    stats = asyncio.run(run_worker(worker, args))
+    stats['hist'] = (stats['hist'].counts, stats['hist'].max)  # serializzabile tra processi
+    return stats
+
+# ========== Report ==========
+def merge(results):
+    total = new_stats()
+    total['elapsed'] = 0.0
+    for stats in results:
+        counts, peak = stats.pop('hist')
+        hist = LatencyHistogram(counts)
+        hist.max = peak
+        total['hist'].merge(hist)
+        for key in ('sent', 'readings', 'saved', 'errors', 'lost', 'skipped', 'timeouts'):
+            total[key] += stats[key]
+        total['elapsed'] = max(total['elapsed'], stats.get('elapsed', 0.0))
+        total['last_error'] = stats['last_error'] or total['last_error']
+    return total
+
+def report(args, total):
+    hist = total['hist']
+    elapsed = total['elapsed'] or args.duration
+    scheduled = total['sent'] + total['skipped']
+    unit = "richieste" if args.transport == "http" else "messaggi"
+
+    def pct(n, d):
+        return f"{100 * n / d:.2f}%" if d else "-"
+
+    print(f"Invii pianificati:   {scheduled} {unit} ({scheduled / elapsed:.0f}/s)")
+    print(f"Invii effettuati:    {total['sent']} {unit}, {total['readings']} letture")
+    print(f"Non inviati:         {total['skipped']} ({pct(total['skipped'], scheduled)}) "
+          f"- limite di {args.concurrency} invii in corso per processo")
+    print(f"Letture confermate:  {total['saved']} ({total['saved'] / elapsed:.0f}/s)")
+    print(f"Errori:              {total['errors']} ({pct(total['errors'], total['sent'])}), "
+          f"di cui timeout {total['timeouts']}" +
+          (f" - ultimo: {total['last_error']}" if total['last_error'] else ""))
+    if args.transport == "udp":
+        print(f"Trame perse (canale): {total['lost']} ({pct(total['lost'], total['sent'])})")
+    if not hist.total:
+        return
+    print(f"Latenza ({hist.total} campioni, dall'istante pianificato): "
+          f"p50 {1000 * hist.percentile(0.50):.1f} ms, "
+          f"p99 {1000 * hist.percentile(0.99):.1f} ms, "
+          f"p999 {1000 * hist.percentile(0.999):.1f} ms, "
+          f"max {1000 * hist.max:.1f} ms")
+    print("Istogramma:")
+    for band, count in hist.bands():
+        bar = "#" * max(1, round(40 * count / hist.total))
+        print(f"  ≤{band:>6} ms  {count:>9}  {bar}")
+
+# ========== Avvio ==========
+def load_config(path):
+    if not path or not os.path.exists(path):
+        return {}
+    with open(path, 'r') as f:
+        return yaml.safe_load(f) or {}
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Generatore di carico: migliaia di sensori su HTTP, MQTT o LoRa (UDP)")
+    parser.add_argument("--config", default="config.yml", help="config.yml da cui leggere zone, broker e intervallo")
+    parser.add_argument("--transport", choices=["http", "mqtt", "udp"], default="http")
+    parser.add_argument("--mode", choices=["single", "bulk", "ndjson"], default="bulk",
+                        help="Solo HTTP: single = POST /data per lettura, bulk/ndjson = POST /data/bulk")
+    parser.add_argument("--sensors", type=int, default=10000, help="Numero di sensori simulati")
+    parser.add_argument("--rate", type=float,
+                        help="Letture/s totali (default: sensori / send_interval di config.yml)")
+    parser.add_argument("--duration", type=float, default=30, help="Durata del test (s)")
+    parser.add_argument("--processes", type=int, default=os.cpu_count() or 1, help="Processi di invio")
+    parser.add_argument("--concurrency", type=int, default=256, help="Invii in corso per processo")
+    parser.add_argument("--batch", type=int,
+                        help="Letture per richiesta HTTP bulk/ndjson (default 500) o per trama LoRa (default 4)")
+    parser.add_argument("--timeout", type=float, default=30, help="Attesa massima di una risposta (s)")
+    parser.add_argument("--url", help="URL del backend (default da backend_url)")
+    parser.add_argument("--broker", help="Broker MQTT (default da mqtt_broker)")
+    parser.add_argument("--mqtt-port", type=int, help="Porta MQTT (default da mqtt_port)")
+    parser.add_argument("--topic", help="Topic MQTT (default da mqtt_topic)")
+    parser.add_argument("--qos", type=int, choices=[0, 1], help="QoS MQTT (default da mqtt_qos)")
+    parser.add_argument("--gateway", default="127.0.0.1", help="Indirizzo del broker di canale LoRa")
+    parser.add_argument("--gateway-port", type=int, default=17000, help="Porta del broker di canale LoRa")
+    parser.add_argument("--counter-start", type=int, default=int(time.time()),
+                        help="Contatore iniziale delle trame LoRa (default: secondi dal 1970)")
+    args = parser.parse_args()
+
+    # I valori non passati da riga di comando arrivano da config.yml, come per il firmware mock
+    config = load_config(args.config)
+    args.zones = config.get("zones", ["zone_north", "zone_south", "zone_east", "zone_west"])
+    if args.url is None:
+        args.url = config.get("backend_url", "http://localhost:8000/data").rsplit("/data", 1)[0]
+    args.broker = args.broker or config.get("mqtt_broker", "localhost")
+    args.mqtt_port = args.mqtt_port or config.get("mqtt_port", 1883)
+    args.topic = args.topic or config.get("mqtt_topic", "sensor/data")
+    args.qos = config.get("mqtt_qos", 1) if args.qos is None else args.qos
+    args.interval = config.get("send_interval", 5)
+    if args.rate is None:
+        args.rate = args.sensors / args.interval
+    if args.batch is None:
+        args.batch = 4 if args.transport == "udp" else 500
+    if args.transport == "udp":
+        if not 1 <= args.batch <= LORA_MAX_BATCH:
+            parser.error(f"--batch: una trama LoRa porta da 1 a {LORA_MAX_BATCH} letture")
+        args.devices = lora_devices(config, args.sensors, args.zones)
+    args.processes = max(1, min(args.processes, args.sensors))
+    return args
+
+# Nodi LoRa simulati: prima quelli di nodi in config.yml, che /frames accetta, poi id successivi
+# che il backend scarta come 'Unknown device' (pesano sul canale ma non sulla verifica)
+def lora_devices(config, count, zones):
+    listed = sorted((int(device), node.get('sensor_id', f"node_{device}"), node.get('zone', 'default'))
+                    for device, node in (config.get('nodi') or {}).items())[:count]
+    first = max((d for d, _, _ in listed), default=0) + 1
+    extra = [(first + i, f"loadgen_node_{first + i}", zones[i % len(zones)]) for i in range(count - len(listed))]
+    if extra:
+        print(f"⚠ {len(extra)} nodi su {count} non sono in 'nodi' di config.yml: "
+              f"con --forward /frames li rifiuta come 'Unknown device'")
+    return listed + extra
+
+def main():
+    args = parse_args()
+    target = {"http": f"{args.url} ({args.mode}, batch {args.batch})" if args.mode != "single" else args.url,
+              "mqtt": f"{args.broker}:{args.mqtt_port}/{args.topic} (QoS {args.qos})",
+              "udp": f"{args.gateway}:{args.gateway_port} (trame da {args.batch} letture)"}[args.transport]
+    print(f"▶ {args.sensors} sensori, {args.rate:.0f} letture/s per {args.duration:.0f} s, "
+          f"{args.processes} processi → {args.transport} {target}")
+
+    if args.processes == 1:
+        results = [process_main(0, args)]
+    else:
+        with multiprocessing.Pool(args.processes) as pool:
+            results = pool.starmap(process_main, [(k, args) for k in range(args.processes)])
+    report(args, merge(results))
+
+if __name__ == "__main__":
+    main()
@@ -1,5 +1,8 @@
 import random
 from datetime import datetime, timedelta
+import frame_auth
+
+KEYS = frame_auth.KeyCache()  # Chiavi dei sensori derivate da FRAME_MASTER_KEY, come nel backend
 
 class SensorMock:
     """
@@ -41,7 +44,7 @@ class SensorMock:
     #    }
 
     def sign_data(self, data):
-        return f"signature_{self.sensor_id}"
+        return frame_auth.sign_reading(KEYS, data)
 
     def timestamp(self):
         lag = random.randint(0, 3)
@@ -1,22 +1,32 @@
 import sys
 import os
 import pytest
+from datetime import datetime, timedelta, timezone
 from fastapi.testclient import TestClient
 
 # Imposta DB temporaneo per i test
 os.environ["DB_FILE"] = "test_sensordata.db"
 os.environ["USE_MQTT"] = "0"  # Disattiva MQTT durante i test
+os.environ.setdefault("FRAME_AUTH_DEV", "1")  # Chiave master di sviluppo se FRAME_MASTER_KEY manca
 
 from backend import app
+import frame_auth
 
-client = TestClient(app)
+frame_keys = frame_auth.KeyCache()
 
-def test_root():
+# Il context manager esegue gli hook di startup/shutdown: connessione al database, tabelle,
+# cache Redis e broadcaster di /stream
+@pytest.fixture(scope="module")
+def client():
+    with TestClient(app) as client:
+        yield client
+
+def test_root(client):
     response = client.get("/")
     assert response.status_code == 200
     assert response.json() == {"message": "Backend attivo!"}
 
-def test_post_and_get_data():
+def test_post_and_get_data(client):
     sample_data = {
         "temperature": 25.0,
         "humidity": 40.0,
@@ -34,7 +44,7 @@ def test_post_and_get_data():
     assert "data" in data
     assert len(data["data"]) > 0
 
-def test_post_data_invalid_signature():
+def test_post_data_invalid_signature(client):
     invalid_data = {
         "temperature": 25.0,
         "humidity": 40.0,
@@ -46,14 +56,14 @@ def test_post_data_invalid_signature():
     assert response.status_code == 400
     assert response.json() == {"detail": "Invalid signature"}
 
-def test_status_endpoint():
+def test_status_endpoint(client):
     response = client.get("/status")
     assert response.status_code == 200
     json_data = response.json()
     assert "status" in json_data and json_data["status"] == "ok"
     assert "records" in json_data and isinstance(json_data["records"], int)
 
-def test_post_data_missing_fields():
+def test_post_data_missing_fields(client):
     incomplete_data = {
         "temperature": 25.0,
         "humidity": 40.0,
@@ -64,7 +74,7 @@ def test_post_data_missing_fields():
     response = client.post("/data", json=incomplete_data)
     assert response.status_code == 422  # Unprocessable Entity
 
-def test_get_data_empty():
+def test_get_data_empty(client):
     # Pulisci database temporaneo prima del test
     if os.path.exists("test_sensordata.db"):
         os.remove("test_sensordata.db")
@@ -82,6 +92,389 @@ def test_get_data_empty():
     assert isinstance(json_data["data"], list)
     assert len(json_data["data"]) == 0
 
+def make_reading(sensor_id="zone_north_sensor_1", **extra):
+    reading = {
+        "sensor_id": sensor_id,
+        "zone": "zone_north",
+        "temperature": 25.0,
+        "humidity_air": 40.0,
+        "humidity_soil": 30.0,
+        "luminosity": 300.0,
+    }
+    reading.update(extra)
+    reading.setdefault("timestamp", datetime.now(timezone.utc).isoformat())
+    reading.setdefault("signature", frame_auth.sign_reading(frame_keys, reading))
+    return reading
+
+def test_post_data_keeps_measurement_time(client):
+    import uuid
+    from datetime import datetime, timedelta, timezone
+    sensor_id = f"zone_north_sensor_single_{uuid.uuid4().hex[:8]}"
+    taken = datetime.now(timezone.utc).replace(microsecond=0) - timedelta(days=2, hours=3)
+    assert client.post("/data", json=make_reading(sensor_id, timestamp=taken.isoformat())).status_code == 200
+    params = {"start_date": f"{taken:%Y-%m-%d}", "end_date": f"{taken:%Y-%m-%d}", "sensor_id": sensor_id}
+    rows = client.get("/data", params=params).json()["data"]
+    assert [datetime.fromisoformat(r["timestamp"]) for r in rows] == [taken]
+
+    far = (datetime.now(timezone.utc) + timedelta(days=400)).isoformat()
+    assert client.post("/data", json=make_reading(sensor_id, timestamp=far)).status_code == 400
+
+def test_parse_bulk_body_array_and_ndjson():
+    from backend import parse_bulk_body
+    assert parse_bulk_body(b'[{"a": 1}, {"a": 2}]') == [{"a": 1}, {"a": 2}]
+    assert parse_bulk_body(b'{"a": 1}\n\n{"a": 2}\n', "application/x-ndjson") == [{"a": 1}, {"a": 2}]
+
+def test_post_bulk_rejects_invalid_readings(client):
+    batch = [make_reading(), make_reading(signature="wrong_signature"), {"sensor_id": "x"}]
+    response = client.post("/data/bulk", json=batch)
+    assert response.status_code == 200
+    json_data = response.json()
+    assert json_data["received"] == 3
+    assert json_data["inserted"] == 1
+    assert [r["index"] for r in json_data["rejected"]] == [1, 2]
+
+def test_post_bulk_ndjson_retry_is_idempotent(client):
+    import json
+    import uuid
+    batch_key = uuid.uuid4().hex
+    body = "\n".join(json.dumps(make_reading(f"zone_north_sensor_{i}")) for i in range(5))
+    headers = {"Content-Type": "application/x-ndjson", "Idempotency-Key": batch_key}
+
+    first = client.post("/data/bulk", content=body, headers=headers)
+    assert first.status_code == 200
+    assert first.json()["inserted"] == 5
+
+    retry = client.post("/data/bulk", content=body, headers=headers)
+    assert retry.status_code == 200
+    assert retry.json()["inserted"] == 0
+    assert retry.json()["duplicates"] == 5
+
+def test_post_bulk_partitions_by_timestamp(client):
+    from datetime import datetime, timedelta, timezone
+    from backend import database
+    old = datetime.now(timezone.utc) - timedelta(days=6)
+    far = (datetime.now(timezone.utc) + timedelta(days=400)).isoformat()
+    batch = [make_reading(timestamp=old.isoformat()), make_reading(timestamp=far)]
+    response = client.post("/data/bulk", json=batch)
+    assert response.status_code == 200
+    assert response.json()["rejected"] == [{"index": 1, "error": "Timestamp beyond partitions"}]
+    # La lettura vecchia ha la sua partizione invece di finire nella DEFAULT
+    assert client.portal.call(database.fetch_val, f"SELECT count(*) FROM sensor_data_{old:%Y_%m}") >= 1
+    assert client.portal.call(database.fetch_val, "SELECT count(*) FROM sensor_data_default") == 0
+
+def test_signed_readings_need_a_recent_timestamp(client):
+    from datetime import datetime, timedelta, timezone
+    now = datetime.now(timezone.utc)
+    undated = {k: v for k, v in make_reading().items() if k != "timestamp"}
+    batch = [undated, make_reading(timestamp=(now - timedelta(days=30)).isoformat()),
+             make_reading(timestamp=(now + timedelta(hours=1)).isoformat())]
+    rejected = client.post("/data/bulk", json=batch).json()["rejected"]
+    assert [r["error"] for r in rejected] == ["Missing timestamp", "Stale timestamp", "Timestamp in the future"]
+    assert client.post("/data", json=batch[1]).status_code == 400
+
+def test_replayed_reading_is_not_saved_again(client):
+    import uuid
+    reading = make_reading(f"zone_north_sensor_replay_{uuid.uuid4().hex[:8]}")
+    assert client.post("/data", json=reading).json()["message"] == "Data received and saved successfully"
+    assert client.post("/data", json=reading).json()["message"] == "Duplicate reading ignored"
+    # La chiave è la firma: lo stesso reinvio su /data/bulk è un duplicato, anche con un'altra chiave del client
+    replay = client.post("/data/bulk", json=[dict(reading, idempotency_key=uuid.uuid4().hex)]).json()
+    assert (replay["inserted"], replay["duplicates"]) == (0, 1)
+    params = {"sensor_id": reading["sensor_id"]}
+    assert len(client.get("/data", params=params).json()["data"]) == 1
+
+def test_create_partition_moves_default_rows(client):
+    from datetime import datetime, timezone
+    from backend import database, create_partition
+    client.portal.call(database.execute, "DROP TABLE IF EXISTS sensor_data_2018_02")  # Database di un'esecuzione precedente
+    client.portal.call(database.execute, "INSERT INTO sensor_data (sensor_id, timestamp) VALUES ('zone_north_sensor_1', '2018-02-10T00:00:00+00:00')")
+    assert client.portal.call(database.fetch_val, "SELECT count(*) FROM sensor_data_default") == 1
+    client.portal.call(create_partition, datetime(2018, 2, 1, tzinfo=timezone.utc))
+    assert client.portal.call(database.fetch_val, "SELECT count(*) FROM sensor_data_default") == 0
+    assert client.portal.call(database.fetch_val, "SELECT count(*) FROM sensor_data_2018_02") == 1
+
+def test_prune_ingest_keys_in_chunks(client):
+    import uuid
+    from backend import database, prune_ingest_keys
+    tag = uuid.uuid4().hex
+    for i in range(5):
+        client.portal.call(database.execute, "INSERT INTO ingest_keys (key, created_at) VALUES (:key, now() - interval '30 days')",
+                           {"key": f"old:{tag}:{i}"})
+    client.portal.call(database.execute, "INSERT INTO ingest_keys (key) VALUES (:key)", {"key": f"new:{tag}"})
+    client.portal.call(prune_ingest_keys, 2)
+    left = client.portal.call(database.fetch_val, "SELECT count(*) FROM ingest_keys WHERE key LIKE :pattern", {"pattern": f"%:{tag}%"})
+    assert left == 1
+
+def test_cursor_roundtrip():
+    from datetime import datetime, timezone
+    from backend import encode_cursor, decode_cursor
+    timestamp = datetime(2025, 6, 1, 12, 30, 0, 123456, tzinfo=timezone.utc)
+    assert decode_cursor(encode_cursor({"timestamp": timestamp, "id": 42})) == (timestamp, 42)
+
+def test_get_data_pages_follow_cursor(client):
+    sensor_id = "zone_north_sensor_paging"
+    client.post("/data/bulk", json=[make_reading(sensor_id) for _ in range(5)])
+
+    seen, cursor = [], None
+    while True:
+        params = {"sensor_id": sensor_id, "limit": 2, "fields": "temperature"}
+        if cursor:
+            params["cursor"] = cursor
+        response = client.get("/data", params=params)
+        assert response.status_code == 200
+        page = response.json()
+        assert len(page["data"]) <= 2
+        assert all(set(row) == {"id", "temperature", "timestamp"} for row in page["data"])
+        seen.extend(row["id"] for row in page["data"])
+        cursor = page["next_cursor"]
+        if not cursor:
+            break
+    assert len(seen) == len(set(seen)) >= 5
+
+def test_get_data_ndjson_stream(client):
+    import json
+    response = client.get("/data", params={"format": "ndjson", "zone": "zone_north"})
+    assert response.status_code == 200
+    assert response.headers["content-type"].startswith("application/x-ndjson")
+    rows = [json.loads(line) for line in response.text.splitlines()]
+    assert all(row["zone"] == "zone_north" for row in rows)
+
+def test_get_data_unknown_field(client):
+    response = client.get("/data", params={"fields": "temperature,password"})
+    assert response.status_code == 400
+
+def test_choose_resolution_picks_coarsest_rollup():
+    from datetime import datetime
+    from backend import choose_resolution, parse_step
+    start, end = datetime(2025, 6, 1), datetime(2025, 6, 8)
+    assert choose_resolution(start, end, "total", 500) == ("1d", None)
+    assert choose_resolution(start, end, parse_step("15m"), 500) == ("5m", 900)
+    assert choose_resolution(start, end, parse_step("2h"), 500) == ("1h", 7200)
+    assert choose_resolution(start, end, None, 100) == ("1h", 7200)
+    # Inizio non allineato a nessun rollup: righe grezze
+    assert choose_resolution(datetime(2025, 6, 1, 0, 0, 30), end, 3600, 500) == (None, 3600)
+
+def test_get_data_aggregate_matches_raw_rows(client):
+    from datetime import datetime, timedelta, timezone
+    sensor_id = "zone_north_sensor_aggregate"
+    day = datetime.now(timezone.utc).replace(hour=0, minute=0, second=0, microsecond=0) - timedelta(days=1)
+    temperatures = [20.0, 22.0, 27.0]
+    client.post("/data/bulk", json=[
+        make_reading(sensor_id, temperature=t, timestamp=(day + timedelta(hours=i)).isoformat())
+        for i, t in enumerate(temperatures)
+    ])
+
+    params = {"start_date": f"{day:%Y-%m-%d}", "end_date": f"{day:%Y-%m-%d}",
+              "sensor_id": sensor_id, "group_by": "sensor", "step": "total"}
+    response = client.get("/data/aggregate", params=params)
+    assert response.status_code == 200
+    json_data = response.json()
+    assert json_data["resolution"] == "1d"
+    row = json_data["data"][0]
+    assert row["n"] == 3
+    assert row["temperature_mean"] == pytest.approx(23.0)
+    assert row["temperature_std"] == pytest.approx(3.6056, abs=1e-3)
+    assert (row["temperature_min"], row["temperature_max"]) == (20.0, 27.0)
+
+    hourly = client.get("/data/aggregate", params={**params, "step": "1h"}).json()
+    assert hourly["resolution"] == "1h"
+    assert [r["n"] for r in hourly["data"]] == [1, 1, 1]
+
+def test_get_data_aggregate_invalid_params(client):
+    assert client.get("/data/aggregate", params={"step": "3 weeks"}).status_code == 400
+    assert client.get("/data/aggregate", params={"group_by": "vineyard"}).status_code == 400
+
+def test_state_reports_latest_reading_per_sensor(client):
+    sensor_id = "zone_north_sensor_state"
+    client.post("/data/bulk", json=[make_reading(sensor_id, temperature=t) for t in (18.0, 19.0)])
+    client.post("/data", json=make_reading(sensor_id, temperature=21.5))
+
+    response = client.get("/state")
+    assert response.status_code == 200
+    json_data = response.json()
+    latest = [s for s in json_data["sensors"] if s["sensor_id"] == sensor_id]
+    assert len(latest) == 1 and latest[0]["temperature"] == 21.5
+    assert json_data["zones"]["zone_north"]["n"] >= 3
+
+def test_repeated_query_is_served_from_cache(client):
+    params = {"start_date": "2025-06-01", "end_date": "2025-06-07", "group_by": "zone", "step": "1d"}
+    first = client.get("/data/aggregate", params=params)
+    hits = client.get("/metrics").json()["counters"].get("cache_hits", 0)
+    second = client.get("/data/aggregate", params=params)
+    assert second.json() == first.json()
+    metrics = client.get("/metrics").json()
+    assert metrics["counters"]["cache_hits"] == hits + 1
+    assert 0 < metrics["cache_hit_rate"] <= 1
+
+def test_cached_query_depends_on_time_window(client):
+    from datetime import datetime, timedelta, timezone
+    sensor_id = "zone_north_sensor_cache_window"
+    day = datetime.now(timezone.utc).replace(hour=0, minute=0, second=0, microsecond=0) - timedelta(days=1)
+    client.post("/data/bulk", json=[
+        make_reading(sensor_id, timestamp=(day + timedelta(hours=h)).isoformat()) for h in (2, 10)
+    ])
+
+    # Stesso giorno, orari diversi: la seconda richiesta non deve ricevere il risultato in cache della prima
+    params = {"start_date": f"{day:%Y-%m-%d}", "end_date": f"{day:%Y-%m-%d}", "sensor_id": sensor_id}
+    morning = {**params, "start_time": "08:00:00"}
+    assert len(client.get("/data", params=morning).json()["data"]) == 1
+    assert len(client.get("/data", params=params).json()["data"]) == 2
+
+    totals = {"group_by": "sensor", "step": "total"}
+    assert client.get("/data/aggregate", params={**morning, **totals}).json()["data"][0]["n"] == 1
+    assert client.get("/data/aggregate", params={**params, **totals}).json()["data"][0]["n"] == 2
+
+def test_cache_generation_does_not_repeat_after_expiry(client):
+    from datetime import datetime, timedelta, timezone
+    from backend import redis_client
+    sensor_id = "zone_north_sensor_cache_expiry"
+    day = datetime.now(timezone.utc).replace(hour=0, minute=0, second=0, microsecond=0) - timedelta(days=3)
+    params = {"start_date": f"{day:%Y-%m-%d}", "end_date": f"{day:%Y-%m-%d}", "sensor_id": sensor_id}
+
+    client.post("/data/bulk", json=[make_reading(sensor_id, timestamp=(day + timedelta(hours=1)).isoformat())])
+    assert len(client.get("/data", params=params).json()["data"]) == 1
+    # Giorno rimasto fermo più a lungo della sua chiave: la prossima lettura non riusa la generazione
+    client.portal.call(redis_client.delete, f"cache:gen:{day:%Y-%m-%d}")
+    client.post("/data/bulk", json=[make_reading(sensor_id, timestamp=(day + timedelta(hours=2)).isoformat())])
+    assert len(client.get("/data", params=params).json()["data"]) == 2
+
+def test_parse_mqtt_message_validates_and_keys_readings():
+    import json
+    from backend import parse_mqtt_message
+    reading = parse_mqtt_message(json.dumps(make_reading()).encode())
+    assert reading is not None
+    assert reading.idempotency_key == f"reading:{reading.sensor_id}:{reading.signature}"
+    assert parse_mqtt_message(b"not json") is None
+    assert parse_mqtt_message(json.dumps(make_reading(signature="wrong_signature")).encode()) is None
+    assert parse_mqtt_message(json.dumps({"sensor_id": "x"}).encode()) is None
+
+def test_mqtt_flush_skips_unsavable_readings(client, monkeypatch):
+    import json
+    import uuid
+    import backend
+
+    class Acks:
+        def __init__(self):
+            self.mids = []
+
+        def ack(self, mid, qos):
+            self.mids.append(mid)
+
+    acks = Acks()
+    monkeypatch.setattr(backend, "mqtt_client", acks)
+    tag = uuid.uuid4().hex[:8]  # Letture nuove anche su un database già usato
+    values = [21.0, 1e39, 22.0, 23.0]  # 1e39 non entra in una colonna REAL
+    batch = [(backend.parse_mqtt_message(json.dumps(make_reading(f"zone_north_sensor_mqtt_{tag}_{i}", temperature=t)).encode()), i, 1)
+             for i, t in enumerate(values)]
+    invalid = backend.metrics.counters['mqtt_invalid']
+
+    client.portal.call(backend.flush_mqtt_batch, batch)
+    assert sorted(acks.mids) == [0, 1, 2, 3]  # Anche la lettura scartata: riconsegnarla non servirebbe
+    assert backend.metrics.counters['mqtt_invalid'] == invalid + 1
+    rows = client.get("/state").json()["sensors"]
+    assert {f"zone_north_sensor_mqtt_{tag}_{i}" for i in (0, 2, 3)} <= {r["sensor_id"] for r in rows}
+
+def test_changes_returns_only_new_readings(client):
+    cursor = client.get("/changes").json()["cursor"]
+    client.post("/data/bulk", json=[make_reading("zone_north_sensor_changes")])
+
+    response = client.get("/changes", params={"since": cursor})
+    assert response.status_code == 200
+    json_data = response.json()
+    assert json_data["reset"] is False
+    assert [r["sensor_id"] for r in json_data["data"]] == ["zone_north_sensor_changes"]
+
+    again = client.get("/changes", params={"since": json_data["cursor"]}).json()
+    assert again["data"] == [] and again["cursor"] == json_data["cursor"]
+
+def test_stream_resets_when_replay_is_incomplete(client, monkeypatch):
+    import backend
+    monkeypatch.setattr(backend, "SSE_REPLAY_MAX", 2)
+
+    async def first_event(since):
+        events = backend.sse_events(since, {"readings"})
+        try:
+            return await events.__anext__()
+        finally:
+            await events.aclose()
+
+    cursor = client.get("/changes").json()["cursor"]
+    client.post("/data/bulk", json=[make_reading("zone_north_sensor_stream")])
+    assert client.portal.call(first_event, cursor).startswith("id: ")
+
+    for _ in range(3):
+        client.post("/data/bulk", json=[make_reading("zone_north_sensor_stream")])
+    # Più voci di SSE_REPLAY_MAX dopo il cursore: reset con la testa attuale come nuovo id
+    head = client.get("/changes").json()["cursor"]
+    assert client.portal.call(first_event, cursor) == f"id: {head}\nevent: reset\ndata: {{}}\n\n"
+
+def test_changes_invalid_cursor(client):
+    assert client.get("/changes", params={"since": "yesterday"}).status_code == 400
+
+def test_anomaly_detector_rules():
+    from datetime import datetime, timedelta, timezone
+    from backend import AnomalyDetector
+    detector = AnomalyDetector({"temperature": (0, 40)}, zscore=4.0, window=60, min_samples=20,
+                               max_rate={"temperature": 10})
+    start = datetime(2025, 6, 1, tzinfo=timezone.utc)
+    readings = [dict(make_reading(temperature=20.0 + (i % 3) * 0.5), id=i, timestamp=start + timedelta(minutes=5 * i))
+                for i in range(30)]
+    assert detector.evaluate(readings) == []
+
+    spike = dict(make_reading(temperature=45.0), id=100, timestamp=start + timedelta(minutes=150))
+    rules = {a["rule"] for a in detector.evaluate([spike]) if a["metric"] == "temperature"}
+    assert rules == {"soglia", "zscore", "variazione"}
+
+def test_anomaly_detector_warm_many_sensors():
+    from backend import AnomalyDetector, METRICHE
+    detector = AnomalyDetector({}, zscore=4.0, window=60, min_samples=20, max_rate={})
+    stats = [{"sensor_id": f"s{i}", "n": 4, **{f"{m}_n": None for m in METRICHE},
+              **{f"{m}_sum": 8.0 * (i + 1) for m in METRICHE}, **{f"{m}_sq": 20.0 * (i + 1) ** 2 for m in METRICHE}}
+             for i in range(1000)]
+    stats[0]["humidity_soil_n"], stats[0]["humidity_soil_sum"], stats[0]["humidity_soil_sq"] = 0, None, None
+    detector.warm(stats)
+    i = detector.index["s9"]
+    assert list(detector.mean[i]) == [20.0] * len(METRICHE)  # somma 80 su 4 campioni
+    assert list(detector.var[i]) == [100.0] * len(METRICHE)  # 2000 / 4 - 20²
+    soil = METRICHE.index("humidity_soil")
+    assert (detector.count[detector.index["s0"], soil], detector.mean[detector.index["s0"], soil]) == (0, 0)
+
+def test_get_anomalies_after_ingest(client):
+    sensor_id = "zone_north_sensor_anomaly"
+    client.post("/data/bulk", json=[make_reading(sensor_id, humidity_soil=80.0)])
+    response = client.get("/anomalies", params={"sensor_id": sensor_id, "rule": "soglia"})
+    assert response.status_code == 200
+    anomalies = response.json()["data"]
+    assert any(a["metric"] == "humidity_soil" and a["threshold"] == 35 for a in anomalies)
+
+def test_reading_signature_covers_fields():
+    from backend import verify_signature
+    reading = make_reading(timestamp="2025-06-01T12:00:00")
+    assert verify_signature(reading)
+    assert not verify_signature({**reading, "temperature": 26.0})
+    assert not verify_signature({**reading, "sensor_id": "zone_north_sensor_2"})
+    assert not verify_signature({**reading, "signature": "signature_zone_north_sensor_1"})
+
+def test_post_frames_verifies_tag_and_counter(client):
+    import time
+    import backend
+    backend.nodes[9001] = {"sensor_id": "zone_north_node_9001", "zone": "zone_north"}
+    readings = [{"temperature": 21.4, "humidity_air": 55.0, "luminosity": 310.0, "age": 5 * i} for i in range(4)]
+    counter = int(time.time())  # Contatore crescente anche tra esecuzioni sullo stesso database
+    first = frame_auth.encode_frame(frame_keys, 9001, counter, readings)
+    tampered = bytearray(frame_auth.encode_frame(frame_keys, 9001, counter + 1, readings))
+    tampered[frame_auth.HEADER.size] ^= 1
+    headers = {"Content-Type": "application/octet-stream"}
+
+    body = client.post("/frames", content=first + bytes(tampered), headers=headers).json()
+    assert (body["accepted"], body["inserted"]) == (1, 4)
+    assert body["rejected"][0]["error"] == "Invalid tag"
+
+    body = client.post("/frames", content=bytes(tampered) + first, headers=headers).json()
+    assert body["accepted"] == 0
+    assert [(r["index"], r["error"]) for r in body["rejected"]] == [(0, "Invalid tag"), (1, "Replayed frame")]
+    assert client.post("/frames", content=first[:-1], headers=headers).status_code == 400
+
 if __name__ == "__main__":
     print("\n▶ Avvio test suite...\n")
     result = pytest.main(["-q", "--disable-warnings", __file__])
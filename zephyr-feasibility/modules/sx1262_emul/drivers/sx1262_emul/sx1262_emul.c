@@ -1,175 +1,892 @@
-// Definisce l'identificativo del driver per l'emulatore nel devicetree
-#define DT_DRV_COMPAT sx1262_emul
+// Emulatore SX1262 a livello di comandi SPI.
+//
+// Il device viene istanziato dal driver Zephyr upstream (semtech,sx1262,
+// CONFIG_LORA_SX126X): qui si registra solo l'emulatore sul bus SPI, che
+// decodifica gli opcode SX126x reali e pilota le linee BUSY/DIO1 tramite
+// gpio-emul. In questo modo lora_config()/lora_send()/lora_recv() girano
+// invariati su native_sim.
+#define DT_DRV_COMPAT semtech_sx1262
 
 // Include il file header locale dell’emulatore SX1262
 #include "sx1262_emul.h"
 
 // Include di sistema e Zephyr
-#include <zephyr/device.h>          // API per gestire i device Zephyr
-#include <zephyr/drivers/spi.h>     // API per il bus SPI
-#include <zephyr/drivers/emul.h>    // Supporto agli emulatori di device
-#include <zephyr/init.h>            // Macro per l'inizializzazione dei device
-#include <zephyr/logging/log.h>     // Logging Zephyr
-#include <string.h>                 // Funzioni standard di stringa
-
-// Include POSIX per invio pacchetti UDP (solo lato emulatore)
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
+#include <zephyr/device.h>                  // API per gestire i device Zephyr
+#include <zephyr/drivers/emul.h>            // Supporto agli emulatori di device
+#include <zephyr/drivers/gpio.h>            // gpio_dt_spec per BUSY/DIO1
+#include <zephyr/drivers/gpio/gpio_emul.h>  // Pilotaggio ingressi GPIO emulati
+#include <zephyr/drivers/spi.h>             // API per il bus SPI
+#include <zephyr/drivers/spi_emul.h>        // API degli emulatori SPI
+#include <zephyr/kernel.h>                  // Timer e spinlock
+#include <zephyr/logging/log.h>             // Logging Zephyr
+#include <zephyr/random/random.h>           // Registri RNG del chip
+#include <string.h>                         // Funzioni standard di stringa
+
+#ifdef CONFIG_SX1262_EMUL_UDP
+// Socket UDP lato host (vedi sx1262_emul_udp_bottom.c)
+#include "sx1262_emul_udp_bottom.h"
+#endif
+
+#ifdef CONFIG_ARCH_POSIX
+// Opzioni da riga di comando di native_sim
+#include "soc.h"
+#include "cmdline.h"
+#endif
 
 // Registra un modulo di log con nome "sx1262_emul" e livello definito in prj.conf
-LOG_MODULE_REGISTER(sx1262_emul, CONFIG_SPI_LOG_LEVEL);
+LOG_MODULE_REGISTER(sx1262_emul, CONFIG_LORA_LOG_LEVEL);
+
+// ------------------------
+// Costanti del chip
+// ------------------------
+
+// Modalita' operative (campo ChipMode del byte di stato)
+enum sx1262_emul_mode {
+    MODE_SLEEP     = 0,
+    MODE_STBY_RC   = 2,
+    MODE_STBY_XOSC = 3,
+    MODE_FS        = 4,
+    MODE_RX        = 5,
+    MODE_TX        = 6,
+};
+
+// Campo CommandStatus del byte di stato
+#define CMD_STATUS_NONE           0x0
+#define CMD_STATUS_DATA_AVAILABLE 0x2
+#define CMD_STATUS_TIMEOUT        0x3
+#define CMD_STATUS_TX_DONE        0x6
+
+// Operazione radio in corso (completata dallo scadere di op_timer)
+enum sx1262_emul_op {
+    OP_NONE,
+    OP_TX,
+    OP_RX,
+    OP_CAD,
+};
 
-// Se SPI_MODE_0 non è definito, lo definisce come 0 (default)
-#ifndef SPI_MODE_0
-#define SPI_MODE_0 0
+// Registri RNG letti da Radio.Random()
+#define SX126X_REG_RANDOM     0x0819
+// Numero massimo di registri memorizzati dall'emulatore
+#define SX1262_EMUL_NUM_REGS  16
+// RSSI istantaneo su canale libero
+#define SX1262_EMUL_NOISE_DBM (-120)
+// Figura di rumore del ricevitore (dB)
+#define SX1262_EMUL_NF_DB     6
+
+// CID LoRaWAN LinkCheckAns usato come ACK dal gateway emulato
+#define SX1262_EMUL_LINK_CHECK_ANS 0x02
+
+#ifdef CONFIG_SX1262_EMUL_CHANNEL_BROKER
+// Protocollo con utils/lora_channel.py (little-endian, senza padding)
+#define SX1262_EMUL_CHAN_MAGIC_TX 0x42435853 // "SXCB"
+#define SX1262_EMUL_CHAN_MAGIC_RX 0x56435853 // "SXCV"
+
+// Metadati premessi al payload di ogni uplink
+struct sx1262_emul_chan_hdr {
+    uint32_t magic;
+    uint16_t seq;
+    uint8_t sf;
+    uint8_t cr;
+    uint32_t freq_hz;
+    uint32_t bw_hz;
+    uint32_t toa_us;
+    int16_t rssi_tenths;               // RSSI al gateway (decimi di dBm)
+    int16_t snr_tenths;                // SNR al gateway senza interferenti
+} __packed;
+
+// Esito deciso dal broker alla fine del time-on-air
+struct sx1262_emul_chan_verdict {
+    uint32_t magic;
+    uint16_t seq;
+    uint8_t delivered;
+    uint8_t reason;                    // 0 ok, 1 sotto sensibilita', 2 collisione
+} __packed;
 #endif
 
-// IP e porta di destinazione per i pacchetti UDP (localhost)
-#define UDP_DEST_IP   "127.0.0.1"
-#define UDP_DEST_PORT 17000
+// ------------------------
+// Strutture dell'emulatore
+// ------------------------
+
+// Configurazione statica (dal devicetree del nodo semtech,sx1262)
+struct sx1262_emul_cfg {
+    struct gpio_dt_spec busy;          // Linea BUSY (ingresso per l'host)
+    struct gpio_dt_spec dio1;          // Linea DIO1 (interrupt per l'host)
+};
+
+// Stato dinamico del chip emulato
+struct sx1262_emul_data {
+    const struct sx1262_emul_cfg *cfg; // Serve alle callback dei timer
+    struct k_spinlock lock;            // Protegge lo stato da SPI e timer
+    struct k_timer op_timer;           // Fine TX / RX / CAD
+    struct k_timer busy_timer;         // Rilascio della linea BUSY
+
+    enum sx1262_emul_mode mode;
+    enum sx1262_emul_op op;
+    bool rx_continuous;
+    uint8_t packet_type;
+    uint8_t cmd_status;
+    uint32_t freq_hz;
+    int8_t tx_power;
+    struct sx1262_emul_modem modem;
+    uint8_t payload_len;               // Lunghezza payload da SetPacketParams
+    bool invert_iq;
+
+    uint16_t irq_status;
+    uint16_t irq_mask;
+    uint16_t dio1_mask;
+
+    uint8_t tx_base;
+    uint8_t rx_base;
+    uint8_t rx_payload_len;
+    uint8_t rx_start;
+    int16_t pkt_rssi;
+    int8_t pkt_snr;
+
+    struct {
+        uint16_t addr;
+        uint8_t val;
+        bool used;
+    } regs[SX1262_EMUL_NUM_REGS];
+
+    uint8_t buffer[256];               // Data buffer interno del chip
+
+    // Downlink in attesa della prossima finestra RX
+    uint8_t dl_buf[CONFIG_SX1262_EMUL_DOWNLINK_MAX];
+    uint8_t dl_len;
+    bool dl_pending;
+    int16_t dl_rssi;
+    int8_t dl_snr;
+
+    struct sx1262_emul_stats stats;
+
+    int16_t path_loss_db;              // Attenuazione nodo ↔ gateway
+    int16_t ul_rssi;                   // Ultimo uplink al gateway (decimi di dBm)
+    int16_t ul_snr;                    // Ultimo uplink al gateway (decimi di dB)
+    uint16_t ul_seq;
+    bool verdict_pending;              // Esito del broker non ancora letto
+
+#ifdef CONFIG_SX1262_EMUL_UDP
+    int udp_fd;
+#endif
+};
 
 // ------------------------
-// Funzione helper per inviare pacchetti via UDP
+// Time-on-air (stessa formula di SX126xGetTimeOnAir in loramac-node)
 // ------------------------
-static int udp_send_packet(const uint8_t *data, size_t len)
+uint32_t sx1262_emul_time_on_air_us(const struct sx1262_emul_modem *modem,
+                                    uint8_t payload_len)
 {
-    int sockfd;
-    struct sockaddr_in dest_addr;
-    int ret;
+    int32_t sf = modem->sf;
+    int32_t num = (payload_len << 3) + (modem->crc_on ? 16 : 0) - (4 * sf) +
+                  (modem->implicit_header ? 0 : 20);
+    int32_t den;
+    int32_t symbols;
+
+    if (modem->bw_hz == 0 || sf < 5 || sf > 12) {
+        return 0;
+    }
+
+    if (sf <= 6) {
+        den = 4 * sf;
+    } else {
+        num += 8;
+        den = modem->ldro ? 4 * (sf - 2) : 4 * sf;
+    }
+    if (num < 0) {
+        num = 0;
+    }
 
-    // Crea un socket UDP
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        LOG_ERR("UDP socket creation failed");
-        return -1;
+    // Simboli (x4) di preambolo + header + payload
+    symbols = ((num + den - 1) / den) * (modem->cr + 4) + modem->preamble_len + 12;
+    if (sf <= 6) {
+        symbols += 2;
     }
 
-    // Inizializza l'indirizzo del destinatario
-    memset(&dest_addr, 0, sizeof(dest_addr));
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(UDP_DEST_PORT);
-    inet_pton(AF_INET, UDP_DEST_IP, &dest_addr.sin_addr);
+    return (uint32_t)(((uint64_t)(4 * symbols + 1) * (1U << (sf - 2)) * 1000000ULL) /
+                      modem->bw_hz);
+}
 
-    // Invia il pacchetto via UDP
-    ret = sendto(sockfd, data, len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    if (ret < 0) {
-        LOG_ERR("UDP sendto failed");
-        close(sockfd);
-        return -1;
+// Bande LoRa: codice SetModulationParams, Hz, 10*log10(Hz) in decimi di dB
+static const struct {
+    uint8_t code;
+    uint32_t hz;
+    int16_t log_tenths;
+} sx1262_emul_bw[] = {
+    { 0x00,   7810, 389 },
+    { 0x08,  10420, 402 },
+    { 0x01,  15630, 419 },
+    { 0x09,  20830, 432 },
+    { 0x02,  31250, 449 },
+    { 0x0A,  41670, 462 },
+    { 0x03,  62500, 480 },
+    { 0x04, 125000, 510 },
+    { 0x05, 250000, 540 },
+    { 0x06, 500000, 570 },
+};
+
+// Codice banda LoRa (SetModulationParams) → Hz
+static uint32_t sx1262_emul_bw_to_hz(uint8_t code)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sx1262_emul_bw); i++) {
+        if (sx1262_emul_bw[i].code == code) {
+            return sx1262_emul_bw[i].hz;
+        }
     }
+    return 0;
+}
+
+// ------------------------
+// Modello di link nodo ↔ gateway (decimi di dB)
+// ------------------------
+
+// Attenuazione di default, sovrascrivibile con --sx1262-path-loss=<dB>
+static int32_t sx1262_emul_path_loss_opt = CONFIG_SX1262_EMUL_PATH_LOSS_DB;
+
+#ifdef CONFIG_ARCH_POSIX
+static void sx1262_emul_add_options(void)
+{
+    static struct args_struct_t sx1262_emul_options[] = {
+        {
+            .option = "sx1262-path-loss",
+            .name = "dB",
+            .type = 'i',
+            .dest = (void *)&sx1262_emul_path_loss_opt,
+            .call_when_found = NULL,
+            .descript = "Path loss between this emulated SX1262 node and the gateway",
+        },
+        ARG_TABLE_ENDMARKER
+    };
+
+    native_add_command_line_opts(sx1262_emul_options);
+}
+
+NATIVE_TASK(sx1262_emul_add_options, PRE_BOOT_1, 10);
+#endif
+
+// Rumore termico nella banda: -174 dBm/Hz + 10*log10(BW) + NF
+static int16_t sx1262_emul_noise_tenths(uint32_t bw_hz)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sx1262_emul_bw); i++) {
+        if (sx1262_emul_bw[i].hz == bw_hz) {
+            return -1740 + sx1262_emul_bw[i].log_tenths + SX1262_EMUL_NF_DB * 10;
+        }
+    }
+    return -1170;
+}
+
+// SNR minimo demodulabile per SF5..SF12 (datasheet, decimi di dB)
+static int16_t sx1262_emul_required_snr_tenths(uint8_t sf)
+{
+    static const int16_t snr[] = { -25, -50, -75, -100, -125, -150, -175, -200 };
+
+    return (sf >= 5 && sf <= 12) ? snr[sf - 5] : 0;
+}
+
+// Fading lognormale: somma di 12 uniformi ≈ gaussiana, sigma in dB
+static int16_t sx1262_emul_fading_tenths(void)
+{
+    int32_t sum = 0;
 
-    // Chiude il socket
-    close(sockfd);
+    for (int i = 0; i < 12; i++) {
+        sum += sys_rand32_get() % 1000;
+    }
+    return (int16_t)(((sum - 6000) * CONFIG_SX1262_EMUL_FADING_DB) / 100);
+}
+
+// ------------------------
+// Accesso byte per byte ai buffer SPI (un comando puo' essere diviso
+// su piu' spi_buf, come fa il driver upstream: header + dati)
+// ------------------------
+static size_t spi_set_len(const struct spi_buf_set *set)
+{
+    size_t len = 0;
+
+    if (set) {
+        for (size_t i = 0; i < set->count; i++) {
+            len += set->buffers[i].len;
+        }
+    }
+    return len;
+}
+
+static uint8_t spi_stream_get(const struct spi_buf_set *set, size_t pos)
+{
+    if (!set) {
+        return 0;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        const struct spi_buf *b = &set->buffers[i];
+
+        if (pos < b->len) {
+            // Buffer NULL: il master trasmette byte NOP (0x00)
+            return b->buf ? ((const uint8_t *)b->buf)[pos] : 0;
+        }
+        pos -= b->len;
+    }
     return 0;
 }
 
+static void spi_stream_put(const struct spi_buf_set *set, size_t pos, uint8_t val)
+{
+    if (!set) {
+        return;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        const struct spi_buf *b = &set->buffers[i];
+
+        if (pos < b->len) {
+            if (b->buf) {
+                ((uint8_t *)b->buf)[pos] = val;
+            }
+            return;
+        }
+        pos -= b->len;
+    }
+}
+
 // ------------------------
-// API reali: invio su SPI
+// Registri
 // ------------------------
-int sx1262_send(const struct device *dev, const uint8_t *data, size_t len)
+static uint8_t sx1262_emul_reg_read(struct sx1262_emul_data *data, uint16_t addr)
 {
-    const struct sx1262_config *cfg = dev->config;
-    const struct spi_config *spi_cfg = &cfg->spi_cfg;
+    if (addr >= SX126X_REG_RANDOM && addr < SX126X_REG_RANDOM + 4) {
+        return (uint8_t)sys_rand32_get();
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(data->regs); i++) {
+        if (data->regs[i].used && data->regs[i].addr == addr) {
+            return data->regs[i].val;
+        }
+    }
+    return 0;
+}
 
-    // Crea buffer SPI di trasmissione
-    struct spi_buf tx_buf = { .buf = (uint8_t *)data, .len = len };
-    struct spi_buf_set tx_set = { .buffers = &tx_buf, .count = 1 };
+static void sx1262_emul_reg_write(struct sx1262_emul_data *data, uint16_t addr, uint8_t val)
+{
+    size_t free_slot = ARRAY_SIZE(data->regs);
 
-    // Scrive via SPI
-    return spi_write(cfg->spi_bus, spi_cfg, &tx_set);
+    for (size_t i = 0; i < ARRAY_SIZE(data->regs); i++) {
+        if (data->regs[i].used && data->regs[i].addr == addr) {
+            data->regs[i].val = val;
+            return;
+        }
+        if (!data->regs[i].used && free_slot == ARRAY_SIZE(data->regs)) {
+            free_slot = i;
+        }
+    }
+    if (free_slot == ARRAY_SIZE(data->regs)) {
+        LOG_WRN("Register table full, dropping write to 0x%04x", addr);
+        return;
+    }
+    data->regs[free_slot].addr = addr;
+    data->regs[free_slot].val = val;
+    data->regs[free_slot].used = true;
 }
 
 // ------------------------
-// API reali: ricezione su SPI
+// Linee GPIO BUSY/DIO1
 // ------------------------
-int sx1262_recv(const struct device *dev, uint8_t *data, size_t max_len)
+static void sx1262_emul_set_pin(const struct gpio_dt_spec *spec, int value)
 {
-    const struct sx1262_config *cfg = dev->config;
-    const struct spi_config *spi_cfg = &cfg->spi_cfg;
+    // Fallisce (ignorato) finche' il driver non configura il pin come ingresso
+    (void)gpio_emul_input_set(spec->port, spec->pin, value);
+}
+
+static void sx1262_emul_update_dio1(struct sx1262_emul_data *data)
+{
+    sx1262_emul_set_pin(&data->cfg->dio1, (data->irq_status & data->dio1_mask) ? 1 : 0);
+}
 
-    // Crea buffer SPI di ricezione
-    struct spi_buf rx_buf = { .buf = data, .len = max_len };
-    struct spi_buf_set rx_set = { .buffers = &rx_buf, .count = 1 };
+static void sx1262_emul_busy_expiry(struct k_timer *timer)
+{
+    struct sx1262_emul_data *data = CONTAINER_OF(timer, struct sx1262_emul_data, busy_timer);
+
+    // In sleep BUSY resta alto fino al risveglio
+    if (data->mode != MODE_SLEEP) {
+        sx1262_emul_set_pin(&data->cfg->busy, 0);
+    }
+}
 
-    // Legge via SPI
-    return spi_read(cfg->spi_bus, spi_cfg, &rx_set);
+// Alza BUSY per il tempo di elaborazione di un comando
+static void sx1262_emul_busy_pulse(struct sx1262_emul_data *data)
+{
+    if (data->mode == MODE_SLEEP) {
+        sx1262_emul_set_pin(&data->cfg->busy, 1);
+        return;
+    }
+    if (CONFIG_SX1262_EMUL_BUSY_TIME_US > 0) {
+        sx1262_emul_set_pin(&data->cfg->busy, 1);
+        data->stats.busy_us += CONFIG_SX1262_EMUL_BUSY_TIME_US;
+        k_timer_start(&data->busy_timer, K_USEC(CONFIG_SX1262_EMUL_BUSY_TIME_US), K_NO_WAIT);
+    }
 }
 
 // ------------------------
-// Struttura API del driver SX1262
+// Gateway emulato: riceve l'uplink e risponde con un ACK (lock acquisito)
 // ------------------------
-static const struct sx1262_emul_driver_api sx1262_emul_driver_api = {
-    .send = sx1262_send,
-    .recv = sx1262_recv,
-};
+static void sx1262_emul_queue_dl(struct sx1262_emul_data *data, const uint8_t *payload,
+                                 uint8_t len, int16_t rssi_dbm, int8_t snr_db)
+{
+    memcpy(data->dl_buf, payload, MIN(len, sizeof(data->dl_buf)));
+    data->dl_len = MIN(len, sizeof(data->dl_buf));
+    data->dl_rssi = rssi_dbm;
+    data->dl_snr = snr_db;
+    data->dl_pending = true;
+}
+
+// Link budget dell'uplink al gateway, calcolato all'avvio della TX
+static void sx1262_emul_gateway_link(struct sx1262_emul_data *data)
+{
+    int16_t noise = sx1262_emul_noise_tenths(data->modem.bw_hz);
+
+    data->ul_rssi = data->tx_power * 10 - data->path_loss_db * 10 +
+                    sx1262_emul_fading_tenths();
+    data->ul_snr = data->ul_rssi - noise;
+    data->ul_seq++;
+}
+
+// Uplink ricevuto (o perso) dal gateway: eventuale ACK nella finestra RX
+static void sx1262_emul_gateway_uplink(struct sx1262_emul_data *data, bool delivered)
+{
+#ifdef CONFIG_SX1262_EMUL_GATEWAY
+    int16_t noise = sx1262_emul_noise_tenths(data->modem.bw_hz);
+    int16_t required = sx1262_emul_required_snr_tenths(data->modem.sf);
+    int16_t rssi;
+    int16_t snr;
+    uint8_t ack[3];
+
+    if (!delivered) {
+        LOG_DBG("GW: uplink lost (SNR %d.%d dB)", data->ul_snr / 10, ABS(data->ul_snr % 10));
+        return;
+    }
+    data->stats.gw_rx_count++;
+
+    // ACK in formato LinkCheckAns: margine sopra il limite di demodulazione
+    ack[0] = SX1262_EMUL_LINK_CHECK_ANS;
+    ack[1] = (uint8_t)CLAMP((data->ul_snr - required) / 10, 0, 254);
+    ack[2] = 1;
+
+    // Downlink dal gateway con la sua potenza e un fading indipendente
+    rssi = CONFIG_SX1262_EMUL_GW_TX_POWER_DBM * 10 - data->path_loss_db * 10 +
+           sx1262_emul_fading_tenths();
+    snr = rssi - noise;
+    if (snr < required || data->dl_pending) {
+        LOG_DBG("GW: ACK lost");
+        return;
+    }
+
+    sx1262_emul_queue_dl(data, ack, sizeof(ack), rssi / 10, (int8_t)CLAMP(snr / 10, -32, 31));
+#else
+    ARG_UNUSED(data);
+    ARG_UNUSED(delivered);
+#endif
+}
+
+// ------------------------
+// Fine delle operazioni radio (contesto timer)
+// ------------------------
+
+// Programma la consegna del downlink in attesa (lock gia' acquisito)
+static void sx1262_emul_schedule_rx(struct sx1262_emul_data *data)
+{
+    uint32_t toa = sx1262_emul_time_on_air_us(&data->modem, data->dl_len);
+
+    data->op = OP_RX;
+    k_timer_start(&data->op_timer, K_USEC(toa), K_NO_WAIT);
+}
+
+static void sx1262_emul_deliver_rx(struct sx1262_emul_data *data)
+{
+    for (size_t i = 0; i < data->dl_len; i++) {
+        data->buffer[(uint8_t)(data->rx_base + i)] = data->dl_buf[i];
+    }
+    data->rx_payload_len = data->dl_len;
+    data->rx_start = data->rx_base;
+    data->pkt_rssi = data->dl_rssi;
+    data->pkt_snr = data->dl_snr;
+    data->dl_pending = false;
+
+    data->irq_status |= SX126X_IRQ_PREAMBLE_DETECTED | SX126X_IRQ_HEADER_VALID |
+                        SX126X_IRQ_RX_DONE;
+    data->cmd_status = CMD_STATUS_DATA_AVAILABLE;
+    data->stats.rx_count++;
+}
+
+static void sx1262_emul_op_expiry(struct k_timer *timer)
+{
+    struct sx1262_emul_data *data = CONTAINER_OF(timer, struct sx1262_emul_data, op_timer);
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    switch (data->op) {
+    case OP_TX:
+        data->irq_status |= SX126X_IRQ_TX_DONE;
+        data->cmd_status = CMD_STATUS_TX_DONE;
+        data->mode = MODE_STBY_RC;
+        data->stats.tx_count++;
+        if (IS_ENABLED(CONFIG_SX1262_EMUL_CHANNEL_BROKER)) {
+            // Con il broker l'esito (collisioni comprese) arriva via UDP
+            data->verdict_pending = true;
+        } else {
+            sx1262_emul_gateway_uplink(data, data->ul_snr >=
+                                       sx1262_emul_required_snr_tenths(data->modem.sf));
+        }
+        break;
+
+    case OP_RX:
+        if (data->dl_pending) {
+            sx1262_emul_deliver_rx(data);
+        } else {
+            data->irq_status |= SX126X_IRQ_TIMEOUT;
+            data->cmd_status = CMD_STATUS_TIMEOUT;
+            data->stats.rx_timeouts++;
+        }
+        if (!data->rx_continuous) {
+            data->mode = MODE_STBY_RC;
+        }
+        break;
+
+    case OP_CAD:
+        // Canale sempre libero: nessun CadDetected
+        data->irq_status |= SX126X_IRQ_CAD_DONE;
+        data->mode = MODE_STBY_RC;
+        break;
+
+    default:
+        break;
+    }
+    data->op = OP_NONE;
+
+    k_spin_unlock(&data->lock, key);
+
+    sx1262_emul_update_dio1(data);
+}
 
 // ------------------------
-// Inizializzazione driver reale
+// Inoltro via UDP del pacchetto trasmesso (solo native_sim)
 // ------------------------
-static int sx1262_real_init(const struct device *dev)
+static void sx1262_emul_forward_tx(struct sx1262_emul_data *data)
 {
-    struct sx1262_data *data = dev->data;
-    const struct sx1262_config *cfg = dev->config;
+#ifdef CONFIG_SX1262_EMUL_UDP
+    uint8_t len = data->payload_len;
+    size_t first = MIN(len, sizeof(data->buffer) - data->tx_base);
+    int ret;
 
-    // Inizializza i buffer a 0
-    data->tx_len = 0;
-    data->rx_len = 0;
+    if (data->udp_fd < 0) {
+        data->udp_fd = sx1262_emul_udp_open(CONFIG_SX1262_EMUL_UDP_ADDR,
+                                            CONFIG_SX1262_EMUL_UDP_PORT);
+        if (data->udp_fd < 0) {
+            LOG_ERR("EMUL UDP socket creation failed");
+            return;
+        }
+    }
 
-    // Configura SPI (1 MHz, 8 bit, MSB first, modalità 0)
-    ((struct sx1262_config *)cfg)->spi_cfg = (struct spi_config){
-        .frequency = 1000000,
-        .operation = SPI_WORD_SET(8) | SPI_TRANSFER_MSB | SPI_MODE_0,
-        .slave = DT_REG_ADDR(DT_DRV_INST(0)),
-        .cs = NULL,
+#ifdef CONFIG_SX1262_EMUL_CHANNEL_BROKER
+    struct {
+        struct sx1262_emul_chan_hdr hdr;
+        uint8_t payload[sizeof(data->buffer)];
+    } __packed pkt = {
+        .hdr = {
+            .magic = SX1262_EMUL_CHAN_MAGIC_TX,
+            .seq = data->ul_seq,
+            .sf = data->modem.sf,
+            .cr = data->modem.cr,
+            .freq_hz = data->freq_hz,
+            .bw_hz = data->modem.bw_hz,
+            .toa_us = sx1262_emul_time_on_air_us(&data->modem, len),
+            .rssi_tenths = data->ul_rssi,
+            .snr_tenths = data->ul_snr,
+        },
     };
 
-    return 0;
+    memcpy(pkt.payload, &data->buffer[data->tx_base], first);
+    memcpy(&pkt.payload[first], data->buffer, len - first);
+    ret = sx1262_emul_udp_send(data->udp_fd, &pkt.hdr, sizeof(pkt.hdr), pkt.payload, len);
+#else
+    // Il payload puo' fare wrap-around nel data buffer circolare
+    ret = sx1262_emul_udp_send(data->udp_fd, &data->buffer[data->tx_base], first,
+                               data->buffer, len - first);
+#endif
+    if (ret < 0) {
+        LOG_ERR("EMUL UDP send failed");
+    } else {
+        LOG_DBG("EMUL UDP sent %u bytes", len);
+    }
+#else
+    ARG_UNUSED(data);
+#endif
+}
+
+// ------------------------
+// Esito dell'ultimo uplink dal broker di canale (prima della finestra RX)
+// ------------------------
+#ifdef CONFIG_SX1262_EMUL_CHANNEL_BROKER
+static void sx1262_emul_channel_verdict(struct sx1262_emul_data *data)
+{
+    struct sx1262_emul_chan_verdict verdict;
+    bool delivered = false;
+    k_spinlock_key_t key;
+    int ret;
+
+    // Il tempo simulato e' fermo durante la recv: la finestra RX non slitta
+    do {
+        ret = sx1262_emul_udp_recv(data->udp_fd, &verdict, sizeof(verdict),
+                                   CONFIG_SX1262_EMUL_CHANNEL_BROKER_TIMEOUT_MS);
+    } while (ret == sizeof(verdict) &&
+             (verdict.magic != SX1262_EMUL_CHAN_MAGIC_RX || verdict.seq != data->ul_seq));
+
+    if (ret == sizeof(verdict)) {
+        delivered = verdict.delivered != 0;
+        LOG_DBG("Channel verdict #%u: %s", verdict.seq,
+                delivered ? "delivered" : (verdict.reason == 2 ? "collision" : "lost"));
+    } else {
+        LOG_WRN("No verdict from channel broker for uplink #%u", data->ul_seq);
+    }
+
+    key = k_spin_lock(&data->lock);
+    data->verdict_pending = false;
+    sx1262_emul_gateway_uplink(data, delivered);
+    k_spin_unlock(&data->lock, key);
 }
+#endif
 
 // ------------------------
-// Emulazione SPI (chiamata ogni transazione SPI)
+// Emulazione SPI (chiamata ogni transazione SPI, cioe' ogni comando)
 // ------------------------
-static int sx1262_emul_io(const struct emul *emul,
-                         const struct spi_config *spi_cfg,
-                         const struct spi_buf_set *tx_bufs,
-                         const struct spi_buf_set *rx_bufs)
+static int sx1262_emul_io(const struct emul *target,
+                          const struct spi_config *spi_cfg,
+                          const struct spi_buf_set *tx_bufs,
+                          const struct spi_buf_set *rx_bufs)
 {
-    struct sx1262_data *data = emul->data;
+    struct sx1262_emul_data *data = target->data;
+    size_t len = MAX(spi_set_len(tx_bufs), spi_set_len(rx_bufs));
+    bool start_tx = false;
+    k_spinlock_key_t key;
+    uint8_t opcode;
+    uint8_t status;
+
+    ARG_UNUSED(spi_cfg);
+
+    if (len == 0) {
+        return 0;
+    }
+
+#ifdef CONFIG_SX1262_EMUL_CHANNEL_BROKER
+    // L'ACK del gateway dipende dall'esito dell'uplink sul canale condiviso
+    if (spi_stream_get(tx_bufs, 0) == SX126X_CMD_SET_RX && data->verdict_pending) {
+        sx1262_emul_channel_verdict(data);
+    }
+#endif
+
+    key = k_spin_lock(&data->lock);
+
+    data->stats.commands++;
+
+    // Qualsiasi fronte su NSS risveglia il chip dallo sleep
+    if (data->mode == MODE_SLEEP) {
+        data->mode = MODE_STBY_RC;
+        LOG_DBG("Wakeup from sleep");
+    }
+
+    // Il chip restituisce il byte di stato durante la fase di comando
+    status = (data->mode << 4) | (data->cmd_status << 1);
+    for (size_t i = 0; i < len; i++) {
+        spi_stream_put(rx_bufs, i, status);
+    }
+
+    opcode = spi_stream_get(tx_bufs, 0);
+    LOG_DBG("CMD 0x%02x (%u bytes)", opcode, (unsigned int)len);
+
+#define P(i)   spi_stream_get(tx_bufs, (i))
+#define P16(i) ((uint16_t)(P(i) << 8) | P((i) + 1))
+
+    switch (opcode) {
+    case SX126X_CMD_GET_STATUS:
+        break;
 
-    // Gestisce trasmissione SPI
-    if (tx_bufs && tx_bufs->count > 0) {
-        const struct spi_buf *buf = &tx_bufs->buffers[0];
+    case SX126X_CMD_SET_STANDBY:
+        k_timer_stop(&data->op_timer);
+        data->op = OP_NONE;
+        data->mode = P(1) ? MODE_STBY_XOSC : MODE_STBY_RC;
+        break;
 
-        // Copia i dati ricevuti
-        memcpy(data->tx_buf, buf->buf, buf->len);
-        data->tx_len = buf->len;
+    case SX126X_CMD_SET_SLEEP:
+        k_timer_stop(&data->op_timer);
+        data->op = OP_NONE;
+        data->mode = MODE_SLEEP;
+        break;
 
-        LOG_INF("EMUL TX: %d bytes", buf->len);
+    case SX126X_CMD_SET_FS:
+        data->mode = MODE_FS;
+        break;
 
-        // Se il comando è TX, invia dati via UDP
-        uint8_t *data = (uint8_t *)buf->buf;
+    case SX126X_CMD_SET_PACKET_TYPE:
+        data->packet_type = P(1);
+        break;
 
-        int udp_ret = udp_send_packet(data, buf->len);
-        if (udp_ret == 0) {
-            LOG_INF("EMUL UDP sent %d bytes", buf->len);
+    case SX126X_CMD_GET_PACKET_TYPE:
+        spi_stream_put(rx_bufs, 2, data->packet_type);
+        break;
+
+    case SX126X_CMD_SET_RF_FREQUENCY: {
+        uint32_t reg = ((uint32_t)P16(1) << 16) | P16(3);
+
+        // Fxtal = 32 MHz, passo 2^-25
+        data->freq_hz = (uint32_t)(((uint64_t)reg * 32000000ULL) >> 25);
+        break;
+    }
+
+    case SX126X_CMD_SET_MODULATION_PARAMS:
+        data->modem.sf = P(1);
+        data->modem.bw_hz = sx1262_emul_bw_to_hz(P(2));
+        data->modem.cr = P(3);
+        data->modem.ldro = P(4) != 0;
+        break;
+
+    case SX126X_CMD_SET_PACKET_PARAMS:
+        data->modem.preamble_len = P16(1);
+        data->modem.implicit_header = P(3) != 0;
+        data->payload_len = P(4);
+        data->modem.crc_on = P(5) != 0;
+        data->invert_iq = P(6) != 0;
+        break;
+
+    case SX126X_CMD_SET_TX_PARAMS:
+        data->tx_power = (int8_t)P(1);
+        break;
+
+    case SX126X_CMD_SET_BUFFER_BASE_ADDRESS:
+        data->tx_base = P(1);
+        data->rx_base = P(2);
+        break;
+
+    case SX126X_CMD_SET_DIO_IRQ_PARAMS:
+        data->irq_mask = P16(1);
+        data->dio1_mask = P16(3) & data->irq_mask;
+        break;
+
+    case SX126X_CMD_GET_IRQ_STATUS:
+        spi_stream_put(rx_bufs, 2, data->irq_status >> 8);
+        spi_stream_put(rx_bufs, 3, data->irq_status & 0xFF);
+        break;
+
+    case SX126X_CMD_CLR_IRQ_STATUS:
+        data->irq_status &= ~P16(1);
+        break;
+
+    case SX126X_CMD_WRITE_BUFFER:
+        for (size_t i = 2; i < len; i++) {
+            data->buffer[(uint8_t)(P(1) + i - 2)] = P(i);
+        }
+        break;
+
+    case SX126X_CMD_READ_BUFFER:
+        for (size_t i = 3; i < len; i++) {
+            spi_stream_put(rx_bufs, i, data->buffer[(uint8_t)(P(1) + i - 3)]);
+        }
+        break;
+
+    case SX126X_CMD_WRITE_REGISTER:
+        for (size_t i = 3; i < len; i++) {
+            sx1262_emul_reg_write(data, P16(1) + i - 3, P(i));
+        }
+        break;
+
+    case SX126X_CMD_READ_REGISTER:
+        for (size_t i = 4; i < len; i++) {
+            spi_stream_put(rx_bufs, i, sx1262_emul_reg_read(data, P16(1) + i - 4));
+        }
+        break;
+
+    case SX126X_CMD_GET_RX_BUFFER_STATUS:
+        spi_stream_put(rx_bufs, 2, data->rx_payload_len);
+        spi_stream_put(rx_bufs, 3, data->rx_start);
+        break;
+
+    case SX126X_CMD_GET_PACKET_STATUS:
+        spi_stream_put(rx_bufs, 2, (uint8_t)(-2 * data->pkt_rssi));
+        spi_stream_put(rx_bufs, 3, (uint8_t)(data->pkt_snr * 4));
+        spi_stream_put(rx_bufs, 4, (uint8_t)(-2 * data->pkt_rssi));
+        break;
+
+    case SX126X_CMD_GET_RSSI_INST:
+        spi_stream_put(rx_bufs, 2, (uint8_t)(-2 * SX1262_EMUL_NOISE_DBM));
+        break;
+
+    case SX126X_CMD_GET_STATS:
+        spi_stream_put(rx_bufs, 2, data->stats.rx_count >> 8);
+        spi_stream_put(rx_bufs, 3, data->stats.rx_count & 0xFF);
+        for (size_t i = 4; i < 8; i++) {
+            spi_stream_put(rx_bufs, i, 0);
+        }
+        break;
+
+    case SX126X_CMD_GET_DEVICE_ERRORS:
+        spi_stream_put(rx_bufs, 2, 0);
+        spi_stream_put(rx_bufs, 3, 0);
+        break;
+
+    case SX126X_CMD_SET_TX: {
+        uint32_t toa = sx1262_emul_time_on_air_us(&data->modem, data->payload_len);
+
+        data->mode = MODE_TX;
+        data->op = OP_TX;
+        data->stats.tx_airtime_us += toa;
+        k_timer_start(&data->op_timer, K_USEC(toa), K_NO_WAIT);
+        sx1262_emul_gateway_link(data);
+        start_tx = true;
+
+        LOG_INF("EMUL TX: %u bytes, SF%u, %u Hz, %d dBm, ToA %u us",
+                data->payload_len, data->modem.sf, data->freq_hz, data->tx_power, toa);
+        break;
+    }
+
+    case SX126X_CMD_SET_RX: {
+        uint32_t timeout = ((uint32_t)P(1) << 16) | P16(2);
+
+        data->mode = MODE_RX;
+        data->op = OP_RX;
+        data->rx_continuous = (timeout == 0xFFFFFF);
+
+        if (data->dl_pending) {
+            sx1262_emul_schedule_rx(data);
+        } else if (timeout != 0 && !data->rx_continuous) {
+            // Timeout in passi da 15.625 us
+            k_timer_start(&data->op_timer, K_USEC(((uint64_t)timeout * 15625U) / 1000U),
+                          K_NO_WAIT);
         } else {
-            LOG_ERR("EMUL UDP send failed");
+            // Attesa indefinita di un downlink
+            k_timer_stop(&data->op_timer);
         }
+        break;
+    }
+
+    case SX126X_CMD_SET_CAD: {
+        // CAD su 2 simboli
+        uint32_t sym_us = (uint32_t)(((1ULL << data->modem.sf) * 1000000ULL) /
+                                     MAX(data->modem.bw_hz, 1U));
+
+        data->mode = MODE_RX;
+        data->op = OP_CAD;
+        k_timer_start(&data->op_timer, K_USEC(2 * sym_us), K_NO_WAIT);
+        break;
+    }
+
+    default:
+        // Calibrate, SetPaConfig, SetRegulatorMode, DIO2/DIO3 ecc.: nessun effetto
+        break;
     }
 
-    // Gestisce ricezione SPI
-    if (rx_bufs && rx_bufs->count > 0) {
-        const struct spi_buf *buf = &rx_bufs->buffers[0];
+#undef P
+#undef P16
 
-        // Scrive dati fittizi (0x42) nel buffer di ricezione
-        memset(buf->buf, 0x42, buf->len);
-        data->rx_len = buf->len;
+    k_spin_unlock(&data->lock, key);
 
-        LOG_INF("EMUL RX: %d bytes", buf->len);
+    if (start_tx) {
+        sx1262_emul_forward_tx(data);
     }
 
+    sx1262_emul_update_dio1(data);
+    sx1262_emul_busy_pulse(data);
+
     return 0;
 }
 
@@ -178,41 +895,104 @@ static const struct spi_emul_api sx1262_emul_spi_api = {
     .io = sx1262_emul_io,
 };
 
+// ------------------------
+// API di backdoor per test e simulazioni
+// ------------------------
+int sx1262_emul_inject_rx(const struct emul *target, const uint8_t *payload,
+                          uint8_t len, int16_t rssi_dbm, int8_t snr_db)
+{
+    struct sx1262_emul_data *data = target->data;
+    k_spinlock_key_t key;
+
+    if (len > sizeof(data->dl_buf)) {
+        return -EINVAL;
+    }
+
+    key = k_spin_lock(&data->lock);
+
+    if (data->dl_pending) {
+        k_spin_unlock(&data->lock, key);
+        return -EBUSY;
+    }
+
+    sx1262_emul_queue_dl(data, payload, len, rssi_dbm, snr_db);
+
+    // Se la finestra RX e' gia' aperta il pacchetto arriva dopo il suo ToA
+    if (data->mode == MODE_RX && data->op != OP_CAD) {
+        sx1262_emul_schedule_rx(data);
+    }
+
+    k_spin_unlock(&data->lock, key);
+    return 0;
+}
+
+void sx1262_emul_set_path_loss(const struct emul *target, int16_t path_loss_db)
+{
+    struct sx1262_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    data->path_loss_db = path_loss_db;
+
+    k_spin_unlock(&data->lock, key);
+}
+
+void sx1262_emul_get_stats(const struct emul *target, struct sx1262_emul_stats *stats)
+{
+    struct sx1262_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    *stats = data->stats;
+
+    k_spin_unlock(&data->lock, key);
+}
+
 // ------------------------
 // Inizializzazione emulatore
 // ------------------------
-static int sx1262_emul_init(const struct emul *emul, const struct device *parent)
+static int sx1262_emul_init(const struct emul *target, const struct device *parent)
 {
-    struct sx1262_data *data = emul->data;
+    struct sx1262_emul_data *data = target->data;
+
+    ARG_UNUSED(parent);
+
+    data->cfg = target->cfg;
+    data->mode = MODE_STBY_RC;
+    data->op = OP_NONE;
+
+    // Valori di reset del chip
+    data->modem.sf = 7;
+    data->modem.bw_hz = 125000;
+    data->modem.cr = 1;
+    data->modem.preamble_len = 8;
+    data->modem.crc_on = true;
+    data->tx_power = 14;
+    data->path_loss_db = (int16_t)sx1262_emul_path_loss_opt;
+
+#ifdef CONFIG_SX1262_EMUL_UDP
+    data->udp_fd = -1;
+#endif
+
+    k_timer_init(&data->op_timer, sx1262_emul_op_expiry, NULL);
+    k_timer_init(&data->busy_timer, sx1262_emul_busy_expiry, NULL);
 
-    // Azzeramento dei dati
-    data->tx_len = 0;
-    data->rx_len = 0;
-    memset(data->tx_buf, 0, sizeof(data->tx_buf));
-    memset(data->rx_buf, 0, sizeof(data->rx_buf));
     return 0;
 }
 
 // ------------------------
-// Macro per istanziare driver reale + emulatore
+// Macro per istanziare l'emulatore sui nodi semtech,sx1262
+// (il device e' definito dal driver upstream)
 // ------------------------
 #define SX1262_EMUL(n)                                                              \
-    static struct sx1262_data sx1262_data_##n;                                      \
-    static struct sx1262_config sx1262_cfg_##n = {                                  \
-        .spi_bus = DEVICE_DT_GET(DT_INST_BUS(n)),                                   \
+    static struct sx1262_emul_data sx1262_emul_data_##n;                            \
+    static const struct sx1262_emul_cfg sx1262_emul_cfg_##n = {                    \
+        .busy = GPIO_DT_SPEC_INST_GET(n, busy_gpios),                               \
+        .dio1 = GPIO_DT_SPEC_INST_GET(n, dio1_gpios),                               \
     };                                                                              \
                                                                                    \
-    DEVICE_DT_INST_DEFINE(n,                                                        \
-        sx1262_real_init, NULL,                                                     \
-        &sx1262_data_##n, &sx1262_cfg_##n,                                          \
-        POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEVICE,                            \
-        &sx1262_emul_driver_api);                                                   \
-                                                                                   \
     EMUL_DT_INST_DEFINE(n,                                                          \
         sx1262_emul_init,                                                           \
-        &sx1262_data_##n, &sx1262_cfg_##n,                                          \
-        &sx1262_emul_spi_api, &sx1262_emul_driver_api);
+        &sx1262_emul_data_##n, &sx1262_emul_cfg_##n,                                \
+        &sx1262_emul_spi_api, NULL);
 
 // Applica la macro per ogni istanza nel devicetree con stato "okay"
 DT_INST_FOREACH_STATUS_OKAY(SX1262_EMUL)
-
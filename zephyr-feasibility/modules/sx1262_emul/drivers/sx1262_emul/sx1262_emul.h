@@ -2,10 +2,11 @@
 #ifndef SX1262_EMUL_H_
 #define SX1262_EMUL_H_
 
-// Include delle API Zephyr per device, SPI e emulatori
+// Include delle API Zephyr per device ed emulatori
 #include <zephyr/device.h>        // Gestione generica dei device
-#include <zephyr/drivers/spi.h>   // API per comunicazione SPI
 #include <zephyr/drivers/emul.h>  // API per creare emulatori di periferiche
+#include <stdbool.h>
+#include <stdint.h>
 
 // Se stiamo usando C++, evita problemi con il name mangling
 #ifdef __cplusplus
@@ -13,37 +14,113 @@ extern "C" {
 #endif
 
 // ------------------------
-// Struttura di configurazione della periferica
+// Opcode SX126x gestiti dall'emulatore (datasheet SX1261/2, cap. 11)
 // ------------------------
-struct sx1262_config {
-    const struct device *spi_bus;      // Riferimento al bus SPI
-    struct spi_config spi_cfg;         // Configurazione SPI (frequenza, modalità, ecc.)
-};
+#define SX126X_CMD_RESET_STATS             0x00
+#define SX126X_CMD_CLR_IRQ_STATUS          0x02
+#define SX126X_CMD_CLR_DEVICE_ERRORS       0x07
+#define SX126X_CMD_SET_DIO_IRQ_PARAMS      0x08
+#define SX126X_CMD_WRITE_REGISTER          0x0D
+#define SX126X_CMD_WRITE_BUFFER            0x0E
+#define SX126X_CMD_GET_STATS               0x10
+#define SX126X_CMD_GET_PACKET_TYPE         0x11
+#define SX126X_CMD_GET_IRQ_STATUS          0x12
+#define SX126X_CMD_GET_RX_BUFFER_STATUS    0x13
+#define SX126X_CMD_GET_PACKET_STATUS       0x14
+#define SX126X_CMD_GET_RSSI_INST           0x15
+#define SX126X_CMD_GET_DEVICE_ERRORS       0x17
+#define SX126X_CMD_READ_REGISTER           0x1D
+#define SX126X_CMD_READ_BUFFER             0x1E
+#define SX126X_CMD_SET_STANDBY             0x80
+#define SX126X_CMD_SET_RX                  0x82
+#define SX126X_CMD_SET_TX                  0x83
+#define SX126X_CMD_SET_SLEEP               0x84
+#define SX126X_CMD_SET_RF_FREQUENCY        0x86
+#define SX126X_CMD_SET_CAD_PARAMS          0x88
+#define SX126X_CMD_CALIBRATE               0x89
+#define SX126X_CMD_SET_PACKET_TYPE         0x8A
+#define SX126X_CMD_SET_MODULATION_PARAMS   0x8B
+#define SX126X_CMD_SET_PACKET_PARAMS       0x8C
+#define SX126X_CMD_SET_TX_PARAMS           0x8E
+#define SX126X_CMD_SET_BUFFER_BASE_ADDRESS 0x8F
+#define SX126X_CMD_SET_PA_CONFIG           0x95
+#define SX126X_CMD_SET_CAD                 0xC5
+#define SX126X_CMD_GET_STATUS              0xC0
+#define SX126X_CMD_SET_FS                  0xC1
+
+// Bit del registro IRQ
+#define SX126X_IRQ_TX_DONE          BIT(0)
+#define SX126X_IRQ_RX_DONE          BIT(1)
+#define SX126X_IRQ_PREAMBLE_DETECTED BIT(2)
+#define SX126X_IRQ_HEADER_VALID     BIT(4)
+#define SX126X_IRQ_CRC_ERR          BIT(6)
+#define SX126X_IRQ_CAD_DONE         BIT(7)
+#define SX126X_IRQ_CAD_DETECTED     BIT(8)
+#define SX126X_IRQ_TIMEOUT          BIT(9)
 
 // ------------------------
-// Struttura dati di runtime della periferica/emulatore
+// Parametri di modulazione/pacchetto LoRa correnti
 // ------------------------
-struct sx1262_data {
-    // Buffer per dati trasmessi e ricevuti (emulazione)
-    uint8_t tx_buf[256];               // Dati trasmessi dall'host alla periferica
-    uint8_t rx_buf[256];               // Dati ricevuti dalla periferica all'host
-    size_t tx_len;                     // Numero di byte trasmessi
-    size_t rx_len;                     // Numero di byte ricevuti
+struct sx1262_emul_modem {
+    uint8_t sf;                        // Spreading factor (5..12)
+    uint32_t bw_hz;                    // Banda in Hz
+    uint8_t cr;                        // Coding rate 1..4 (4/5..4/8)
+    bool ldro;                         // Low data rate optimization
+    uint16_t preamble_len;             // Lunghezza preambolo (simboli)
+    bool implicit_header;              // Header implicito
+    bool crc_on;                       // CRC del payload abilitato
 };
 
 // ------------------------
-// API esposte dal driver/emulatore SX1262
+// Statistiche raccolte dall'emulatore (per profiling senza hardware)
 // ------------------------
-struct sx1262_emul_driver_api {
-    int (*send)(const struct device *dev, const uint8_t *data, size_t len);     // API di invio SPI
-    int (*recv)(const struct device *dev, uint8_t *data, size_t max_len);       // API di ricezione SPI
+struct sx1262_emul_stats {
+    uint32_t tx_count;                 // Pacchetti trasmessi (TxDone)
+    uint32_t rx_count;                 // Pacchetti ricevuti (RxDone)
+    uint32_t rx_timeouts;              // Finestre RX scadute senza pacchetti
+    uint32_t commands;                 // Transazioni SPI elaborate
+    uint32_t gw_rx_count;              // Uplink ricevuti dal gateway emulato
+    uint64_t tx_airtime_us;            // Tempo totale in TX
+    uint64_t busy_us;                  // Tempo totale con BUSY alto
 };
 
 // ------------------------
-// Funzioni pubbliche del driver
+// Funzioni pubbliche dell'emulatore
 // ------------------------
-int sx1262_send(const struct device *dev, const uint8_t *data, size_t len);     // Invio dati su SPI
-int sx1262_recv(const struct device *dev, uint8_t *data, size_t max_len);       // Ricezione dati da SPI
+
+/**
+ * @brief Calcola il time-on-air di un pacchetto LoRa (formula del datasheet)
+ *
+ * @param modem        Parametri di modulazione e pacchetto
+ * @param payload_len  Lunghezza del payload in byte
+ * @return durata in microsecondi
+ */
+uint32_t sx1262_emul_time_on_air_us(const struct sx1262_emul_modem *modem,
+                                    uint8_t payload_len);
+
+/**
+ * @brief Accoda un pacchetto in downlink per la prossima finestra RX
+ *
+ * Il pacchetto viene consegnato (RxDone su DIO1) quando il driver esegue
+ * SetRx, dopo il suo time-on-air.
+ *
+ * @return 0 se accodato, -EBUSY se un downlink e' gia' in attesa
+ */
+int sx1262_emul_inject_rx(const struct emul *target, const uint8_t *payload,
+                          uint8_t len, int16_t rssi_dbm, int8_t snr_db);
+
+/**
+ * @brief Imposta l'attenuazione di percorso verso il gateway emulato
+ *
+ * Il default arriva da CONFIG_SX1262_EMUL_PATH_LOSS_DB o dall'opzione
+ * --sx1262-path-loss=<dB> di native_sim (un valore per processo/nodo).
+ */
+void sx1262_emul_set_path_loss(const struct emul *target, int16_t path_loss_db);
+
+/**
+ * @brief Copia le statistiche correnti dell'emulatore
+ */
+void sx1262_emul_get_stats(const struct emul *target, struct sx1262_emul_stats *stats);
 
 // Fine del blocco extern "C" per C++
 #ifdef __cplusplus
@@ -52,4 +129,3 @@ int sx1262_recv(const struct device *dev, uint8_t *data, size_t max_len);
 
 // Fine delle protezioni contro inclusioni multiple
 #endif // SX1262_EMUL_H_
-
@@ -0,0 +1,69 @@
+// Lato host dell'emulatore SX1262 (compilato nel native_simulator)
+
+#include "sx1262_emul_udp_bottom.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+int sx1262_emul_udp_open(const char *addr, int port)
+{
+	struct sockaddr_in dest_addr;
+	int fd;
+
+	// Crea un socket UDP
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	// Inizializza l'indirizzo del destinatario
+	memset(&dest_addr, 0, sizeof(dest_addr));
+	dest_addr.sin_family = AF_INET;
+	dest_addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &dest_addr.sin_addr) != 1) {
+		close(fd);
+		return -1;
+	}
+
+	// "connect" su UDP fissa il peer: send()/recv() senza indirizzo
+	if (connect(fd, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int sx1262_emul_udp_send(int fd, const void *hdr, size_t hdr_len,
+			 const void *data, size_t data_len)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)hdr, .iov_len = hdr_len },
+		{ .iov_base = (void *)data, .iov_len = data_len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = 2,
+	};
+
+	return (int)sendmsg(fd, &msg, 0);
+}
+
+int sx1262_emul_udp_recv(int fd, void *buf, size_t len, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int ret;
+
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	ret = (int)recv(fd, buf, len, 0);
+	return ret < 0 ? -1 : ret;
+}
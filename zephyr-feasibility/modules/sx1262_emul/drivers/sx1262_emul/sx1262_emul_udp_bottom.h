@@ -0,0 +1,31 @@
+// Lato "host" dell'emulatore SX1262: socket UDP verso il gateway simulato.
+//
+// Questo file viene compilato nel native_simulator (fuori dal kernel Zephyr)
+// e puo' quindi usare direttamente le API POSIX dell'host.
+
+#ifndef SX1262_EMUL_UDP_BOTTOM_H_
+#define SX1262_EMUL_UDP_BOTTOM_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Apre un socket UDP "connesso" verso addr:port. Ritorna il fd o -1.
+int sx1262_emul_udp_open(const char *addr, int port);
+
+// Invia un datagramma composto da due parti (la seconda puo' essere vuota).
+// Ritorna il numero di byte inviati o -1.
+int sx1262_emul_udp_send(int fd, const void *hdr, size_t hdr_len,
+			 const void *data, size_t data_len);
+
+// Riceve un datagramma attendendo al massimo timeout_ms (0 = non bloccante).
+// Ritorna il numero di byte ricevuti, 0 se nulla e' disponibile, -1 su errore.
+int sx1262_emul_udp_recv(int fd, void *buf, size_t len, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SX1262_EMUL_UDP_BOTTOM_H_
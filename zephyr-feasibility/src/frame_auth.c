@@ -0,0 +1,227 @@
+// -----------------------------------------------------------------------------
+// Uplink autenticato a trame
+//
+// Le letture si accumulano in un batch di CONFIG_APP_FRAME_AUTH_BATCH record
+// a 12 byte; la trama porta un solo tag HMAC-SHA256 troncato a 4 byte (PSA
+// Crypto), quindi il costo del MAC e i byte del tag si dividono tra tutte le
+// letture del batch. Il contatore cresce a ogni trama e il backend scarta
+// quelle con un contatore gia' visto (replay). Con CONFIG_SETTINGS il
+// contatore sopravvive ai reset: si salva la fine di un blocco di
+// CONFIG_APP_FRAME_AUTH_COUNTER_STEP contatori prima di usarne il primo, e
+// dopo un reset si riparte da li'.
+// -----------------------------------------------------------------------------
+
+#include "frame_auth.h"
+#include "payload.h"
+#include "hot_path.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+#include <psa/crypto.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef CONFIG_SETTINGS
+#include <zephyr/settings/settings.h>
+#endif
+
+#ifdef CONFIG_ARCH_POSIX
+// Opzioni da riga di comando di native_sim
+#include "soc.h"
+#include "cmdline.h"
+#endif
+
+LOG_MODULE_REGISTER(frame_auth, CONFIG_APP_LOG_LEVEL);
+
+#define FRAME_AUTH_ALG PSA_ALG_TRUNCATED_MAC(PSA_ALG_HMAC(PSA_ALG_SHA_256), FRAME_AUTH_TAG_LEN)
+
+// Chiave e id del nodo non hanno default: un build senza (prod.conf senza
+// NODE_CONF) non deve partire con una chiave pubblica o un id condiviso
+BUILD_ASSERT(sizeof(CONFIG_APP_FRAME_AUTH_KEY) == 2 * 32 + 1,
+	     "CONFIG_APP_FRAME_AUTH_KEY must be 64 hex digits (scripts/frame_auth.py key)");
+BUILD_ASSERT(CONFIG_APP_FRAME_AUTH_DEVICE_ID > 0, "CONFIG_APP_FRAME_AUTH_DEVICE_ID is not set");
+
+static psa_key_id_t key_id;
+static uint32_t counter;  // Contatore della prossima trama
+
+// Id e chiave del nodo, sovrascrivibili su native_sim con --frame-auth-device
+// e --frame-auth-key: piu' nodi emulati dallo stesso zephyr.exe restano
+// dispositivi distinti per il backend
+static uint32_t device_id = CONFIG_APP_FRAME_AUTH_DEVICE_ID;
+static char *key_hex = CONFIG_APP_FRAME_AUTH_KEY;
+
+#ifdef CONFIG_ARCH_POSIX
+static void frame_auth_add_options(void)
+{
+	static struct args_struct_t frame_auth_options[] = {
+		{
+			.option = "frame-auth-device",
+			.name = "id",
+			.type = 'u',
+			.dest = (void *)&device_id,
+			.call_when_found = NULL,
+			.descript = "Device id of this node, listed under nodi in config.yml",
+		},
+		{
+			.option = "frame-auth-key",
+			.name = "hex",
+			.type = 's',
+			.dest = (void *)&key_hex,
+			.call_when_found = NULL,
+			.descript = "Key of this node (scripts/frame_auth.py key --device <id>)",
+		},
+		ARG_TABLE_ENDMARKER
+	};
+
+	native_add_command_line_opts(frame_auth_options);
+}
+
+NATIVE_TASK(frame_auth_add_options, PRE_BOOT_1, 10);
+#endif
+
+#ifdef CONFIG_SETTINGS
+static uint32_t reserved;  // Primo contatore non ancora riservato in flash
+
+static int frame_auth_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+				   void *cb_arg)
+{
+	if (!settings_name_steq(name, "counter", NULL)) {
+		return -ENOENT;
+	}
+	if (len != sizeof(reserved) || read_cb(cb_arg, &reserved, sizeof(reserved)) != sizeof(reserved)) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(frame_auth, "frame_auth", NULL, frame_auth_settings_set, NULL,
+			       NULL);
+
+// Salva un nuovo blocco di contatori prima di usare il primo: dopo un reset
+// nessun contatore gia' trasmesso viene riusato
+static void frame_auth_reserve(void)
+{
+	uint32_t next = counter + CONFIG_APP_FRAME_AUTH_COUNTER_STEP;
+	int ret;
+
+	if (counter < reserved) {
+		return;
+	}
+	ret = settings_save_one("frame_auth/counter", &next, sizeof(next));
+	if (ret < 0) {
+		// La trama parte comunque: al prossimo reset il backend scartera'
+		// come replay le trame fino al contatore gia' usato
+		LOG_WRN("Frame counter not saved: %d", ret);
+	}
+	reserved = next;
+}
+#else
+static inline void frame_auth_reserve(void)
+{
+}
+#endif
+
+int frame_auth_init(void)
+{
+	psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+	uint8_t key[32];
+	psa_status_t status;
+
+	if (key_id != PSA_KEY_ID_NULL) {
+		// Gia' inizializzato (es. benchmark e app_main()): una seconda chiave
+		// e un altro blocco di contatori riservato sarebbero sprechi
+		return 0;
+	}
+	if (device_id == 0 ||
+	    hex2bin(key_hex, strlen(key_hex), key, sizeof(key)) != sizeof(key)) {
+		return -EINVAL;
+	}
+
+	status = psa_crypto_init();
+	if (status != PSA_SUCCESS) {
+		LOG_ERR("PSA crypto init failed: %d", status);
+		return -EIO;
+	}
+
+	psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_SIGN_MESSAGE);
+	psa_set_key_algorithm(&attr, FRAME_AUTH_ALG);
+	psa_set_key_type(&attr, PSA_KEY_TYPE_HMAC);
+	psa_set_key_bits(&attr, PSA_BYTES_TO_BITS(sizeof(key)));
+	status = psa_import_key(&attr, key, sizeof(key), &key_id);
+	memset(key, 0, sizeof(key));
+	if (status != PSA_SUCCESS) {
+		LOG_ERR("Frame key import failed: %d", status);
+		return -EIO;
+	}
+
+#ifdef CONFIG_SETTINGS
+	if (settings_subsys_init() == 0) {
+		settings_load_subtree("frame_auth");
+	}
+	counter = reserved;
+#endif
+	return 0;
+}
+
+APP_HOT bool frame_auth_add(struct frame_auth_batch *batch, const struct sensor_value *temp,
+			    const struct sensor_value *hum, const struct sensor_value *lux)
+{
+	uint8_t *rec = batch->record[batch->count];
+
+	sys_put_le16((uint16_t)CLAMP(payload_tenths(temp), INT16_MIN, INT16_MAX), &rec[0]);
+	sys_put_le16((uint16_t)CLAMP(payload_tenths(hum), 0, FRAME_AUTH_SOIL_NONE - 1), &rec[2]);
+	sys_put_le16(FRAME_AUTH_SOIL_NONE, &rec[4]);  // Nessun sensore di umidita' del suolo
+	sys_put_le32((uint32_t)MAX(payload_tenths(lux), 0), &rec[6]);
+	batch->taken_ms[batch->count] = k_uptime_get_32();
+
+	return ++batch->count == CONFIG_APP_FRAME_AUTH_BATCH;
+}
+
+int frame_auth_seal(struct frame_auth_batch *batch, uint8_t *buf, size_t size)
+{
+	size_t len = FRAME_AUTH_LEN(batch->count) - FRAME_AUTH_TAG_LEN;
+	uint32_t now = k_uptime_get_32();
+	size_t mac_len;
+	psa_status_t status;
+
+	if (batch->count == 0) {
+		return -ENODATA;
+	}
+	if (size < len + FRAME_AUTH_TAG_LEN) {
+		batch->count = 0;
+		return -ENOSPC;
+	}
+
+	frame_auth_reserve();
+
+	buf[0] = FRAME_AUTH_TYPE;
+	buf[1] = FRAME_AUTH_VERSION;
+	sys_put_le32(device_id, &buf[2]);
+	sys_put_le32(counter, &buf[6]);
+	buf[10] = batch->count;
+
+	for (uint8_t i = 0; i < batch->count; i++) {
+		uint8_t *rec = &buf[FRAME_AUTH_HDR_LEN + i * FRAME_AUTH_RECORD_LEN];
+		uint32_t age_s = (now - batch->taken_ms[i]) / MSEC_PER_SEC;
+
+		memcpy(rec, batch->record[i], FRAME_AUTH_RECORD_LEN - 2);
+		sys_put_le16((uint16_t)MIN(age_s, UINT16_MAX), &rec[FRAME_AUTH_RECORD_LEN - 2]);
+	}
+
+	status = psa_mac_compute(key_id, FRAME_AUTH_ALG, buf, len, &buf[len], FRAME_AUTH_TAG_LEN,
+				 &mac_len);
+	batch->count = 0;
+	if (status != PSA_SUCCESS || mac_len != FRAME_AUTH_TAG_LEN) {
+		return -EIO;
+	}
+
+	counter++;
+	return len + FRAME_AUTH_TAG_LEN;
+}
+
+uint32_t frame_auth_counter(void)
+{
+	return counter;
+}
@@ -0,0 +1,79 @@
+// Uplink autenticato: un batch di letture in una trama binaria con un solo
+// tag HMAC-SHA256 troncato e un contatore anti-replay.
+#ifndef FRAME_AUTH_H_
+#define FRAME_AUTH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/drivers/sensor.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Formato little-endian, lo stesso di feasibility/scripts/frame_auth.py:
+//   intestazione: tipo 0xFD, versione, device id (u32), contatore (u32), n. letture (u8)
+//   per lettura:  temperatura (i16, decimi di °C), umidita' aria (u16, decimi di %),
+//                 umidita' suolo (u16, 0xFFFF = non misurata), luce (u32, decimi di lux),
+//                 eta' (u16, secondi prima dell'invio)
+//   tag:          primi FRAME_AUTH_TAG_LEN byte di HMAC-SHA256(chiave del nodo, tutto il resto)
+#define FRAME_AUTH_TYPE        0xFD
+#define FRAME_AUTH_VERSION     1
+#define FRAME_AUTH_HDR_LEN     11
+#define FRAME_AUTH_RECORD_LEN  12
+#define FRAME_AUTH_TAG_LEN     4
+#define FRAME_AUTH_SOIL_NONE   0xFFFF
+
+#define FRAME_AUTH_LEN(n) \
+	(FRAME_AUTH_HDR_LEN + (n) * FRAME_AUTH_RECORD_LEN + FRAME_AUTH_TAG_LEN)
+#define FRAME_AUTH_MAX_LEN FRAME_AUTH_LEN(CONFIG_APP_FRAME_AUTH_BATCH)
+
+/**
+ * @brief Letture in attesa della prossima trama
+ */
+struct frame_auth_batch {
+	uint8_t record[CONFIG_APP_FRAME_AUTH_BATCH][FRAME_AUTH_RECORD_LEN]; ///< Letture codificate
+	uint32_t taken_ms[CONFIG_APP_FRAME_AUTH_BATCH];  ///< Uptime di ogni lettura
+	uint8_t count;                                   ///< Letture nel batch
+};
+
+/**
+ * @brief Importa la chiave del nodo e recupera il contatore delle trame
+ *
+ * Le chiamate successive alla prima non fanno nulla.
+ *
+ * @return 0, -EINVAL se la chiave o il device id non sono validi, -EIO se
+ *         PSA Crypto non si inizializza
+ */
+int frame_auth_init(void);
+
+/**
+ * @brief Aggiunge una lettura al batch
+ *
+ * @return true se il batch e' pieno e va sigillato con frame_auth_seal()
+ */
+bool frame_auth_add(struct frame_auth_batch *batch, const struct sensor_value *temp,
+		    const struct sensor_value *hum, const struct sensor_value *lux);
+
+/**
+ * @brief Scrive la trama del batch con contatore e tag
+ *
+ * Il batch si svuota anche in caso di errore: le letture di una trama non
+ * sigillata vanno perse invece di bloccare le successive.
+ *
+ * @return lunghezza della trama, -ENODATA se il batch e' vuoto, -ENOSPC se
+ *         buf e' troppo piccolo, -EIO se il MAC fallisce
+ */
+int frame_auth_seal(struct frame_auth_batch *batch, uint8_t *buf, size_t size);
+
+/**
+ * @brief Contatore che verra' usato dalla prossima trama
+ */
+uint32_t frame_auth_counter(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_AUTH_H_
@@ -0,0 +1,20 @@
+// Attributi per il codice caldo eseguito a ogni lettura.
+#ifndef HOT_PATH_H_
+#define HOT_PATH_H_
+
+#include <zephyr/sys/util.h>
+
+// Con CONFIG_APP_HOT_PATH_IRAM le funzioni marcate APP_HOT vanno in IRAM
+// (.iram1.*, raccolta in .iram0.text dal linker script ESP32): dopo il
+// risveglio girano senza attendere il riempimento della cache della flash.
+// Solo codice foglia che fa il lavoro da se' (payload_tenths, frame_auth_add,
+// hist_add): i wrapper che passano subito a driver, PSA, snprintf o k_msleep
+// restano in flash, dove gira comunque quasi tutto il loro tempo, e in IRAM
+// costerebbero SRAM senza guadagno.
+#ifdef CONFIG_APP_HOT_PATH_IRAM
+#define APP_HOT __attribute__((section(".iram1." STRINGIFY(__COUNTER__))))
+#else
+#define APP_HOT
+#endif
+
+#endif // HOT_PATH_H_
@@ -0,0 +1,134 @@
+// -----------------------------------------------------------------------------
+// Adaptive Data Rate lato nodo
+//
+// Stesso schema dell'ADR LoRaWAN lato network server, ma eseguito sul nodo:
+// dal margine massimo degli ultimi uplink si calcola quanti passi da 3 dB si
+// possono "spendere", prima riducendo lo SF (il time-on-air si dimezza a ogni
+// passo) e poi la potenza. Dopo perdite consecutive si torna indietro.
+// -----------------------------------------------------------------------------
+
+#include "lora_adr.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(lora_adr, CONFIG_APP_LOG_LEVEL);
+
+#define ADR_STEP_DB        3
+#define ADR_POWER_STEP_DB  2
+
+// SNR minimo per SF5..SF12 (datasheet SX1261/2, decimi di dB)
+static const int16_t required_snr[] = { -25, -50, -75, -100, -125, -150, -175, -200 };
+
+int16_t lora_adr_required_snr(uint8_t sf)
+{
+	if (sf < 5 || sf > 12) {
+		return 0;
+	}
+	return required_snr[sf - 5];
+}
+
+static void lora_adr_reset_history(struct lora_adr *adr)
+{
+	adr->count = 0;
+	adr->missed = 0;
+}
+
+void lora_adr_init(struct lora_adr *adr, uint8_t sf, int8_t tx_power)
+{
+	memset(adr, 0, sizeof(*adr));
+	adr->sf = CLAMP(sf, CONFIG_APP_LORA_ADR_SF_MIN, CONFIG_APP_LORA_ADR_SF_MAX);
+	adr->tx_power = CLAMP(tx_power, CONFIG_APP_LORA_ADR_TX_POWER_MIN,
+			      CONFIG_APP_LORA_ADR_TX_POWER_MAX);
+}
+
+// Applica i passi di margine disponibili (positivi o negativi)
+static bool lora_adr_apply(struct lora_adr *adr, int nstep)
+{
+	uint8_t sf = adr->sf;
+	int8_t power = adr->tx_power;
+
+	while (nstep > 0 && sf > CONFIG_APP_LORA_ADR_SF_MIN) {
+		sf--;
+		nstep--;
+	}
+	while (nstep > 0 && power - ADR_POWER_STEP_DB >= CONFIG_APP_LORA_ADR_TX_POWER_MIN) {
+		power -= ADR_POWER_STEP_DB;
+		nstep--;
+	}
+	while (nstep < 0 && power + ADR_POWER_STEP_DB <= CONFIG_APP_LORA_ADR_TX_POWER_MAX) {
+		power += ADR_POWER_STEP_DB;
+		nstep++;
+	}
+
+	if (sf == adr->sf && power == adr->tx_power) {
+		return false;
+	}
+
+	adr->sf = sf;
+	adr->tx_power = power;
+	return true;
+}
+
+bool lora_adr_on_ack(struct lora_adr *adr, const uint8_t *payload, int len, int8_t snr)
+{
+	int8_t margin;
+	int nstep;
+
+	adr->missed = 0;
+
+	if (len >= LORA_ADR_LINK_CHECK_ANS_LEN && payload[0] == LORA_ADR_LINK_CHECK_ANS) {
+		// Margine sopra il limite di demodulazione misurato dal gateway
+		margin = (int8_t)MIN(payload[1], INT8_MAX);
+	} else {
+		// Stima dal downlink, assumendo il canale reciproco
+		margin = (int8_t)((snr * 10 - lora_adr_required_snr(adr->sf)) / 10);
+	}
+
+	// Storico circolare degli ultimi margini
+	if (adr->count < ARRAY_SIZE(adr->margin)) {
+		adr->margin[adr->count++] = margin;
+	} else {
+		memmove(&adr->margin[0], &adr->margin[1], sizeof(adr->margin) - 1);
+		adr->margin[ARRAY_SIZE(adr->margin) - 1] = margin;
+	}
+
+	if (adr->count < ARRAY_SIZE(adr->margin)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < adr->count; i++) {
+		margin = MAX(margin, adr->margin[i]);
+	}
+
+	nstep = (margin - CONFIG_APP_LORA_ADR_MARGIN_DB) / ADR_STEP_DB;
+	if (!lora_adr_apply(adr, nstep)) {
+		return false;
+	}
+
+	LOG_DBG("Margin %d dB -> SF%u, %d dBm", margin, adr->sf, adr->tx_power);
+	lora_adr_reset_history(adr);
+	return true;
+}
+
+bool lora_adr_on_loss(struct lora_adr *adr)
+{
+	if (++adr->missed < CONFIG_APP_LORA_ADR_BACKOFF_LOSSES) {
+		return false;
+	}
+
+	// Prima la potenza massima, poi uno SF piu' robusto
+	if (adr->tx_power < CONFIG_APP_LORA_ADR_TX_POWER_MAX) {
+		adr->tx_power = CONFIG_APP_LORA_ADR_TX_POWER_MAX;
+	} else if (adr->sf < CONFIG_APP_LORA_ADR_SF_MAX) {
+		adr->sf++;
+	} else {
+		adr->missed = 0;
+		return false;
+	}
+
+	LOG_DBG("Backoff -> SF%u, %d dBm", adr->sf, adr->tx_power);
+	lora_adr_reset_history(adr);
+	return true;
+}
@@ -0,0 +1,59 @@
+// Adaptive Data Rate lato nodo: sceglie SF e potenza TX in base al margine
+// di link riportato negli ACK del gateway.
+#ifndef LORA_ADR_H_
+#define LORA_ADR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ACK del gateway nel formato LoRaWAN LinkCheckAns: [CID, margine dB, n. gateway]
+#define LORA_ADR_LINK_CHECK_ANS     0x02
+#define LORA_ADR_LINK_CHECK_ANS_LEN 3
+
+/**
+ * @brief Stato del controllore ADR
+ */
+struct lora_adr {
+	uint8_t sf;                                   ///< Spreading factor corrente
+	int8_t tx_power;                              ///< Potenza TX corrente (dBm)
+	int8_t margin[CONFIG_APP_LORA_ADR_HISTORY];   ///< Ultimi margini di link (dB)
+	uint8_t count;                                ///< Margini validi nello storico
+	uint8_t missed;                               ///< ACK consecutivi persi
+};
+
+/**
+ * @brief Inizializza il controllore con la configurazione radio di partenza
+ */
+void lora_adr_init(struct lora_adr *adr, uint8_t sf, int8_t tx_power);
+
+/**
+ * @brief Aggiorna l'ADR dopo un downlink ricevuto nella finestra RX
+ *
+ * Se il payload e' un LinkCheckAns usa il margine misurato dal gateway
+ * sull'uplink, altrimenti lo stima dall'SNR del downlink.
+ *
+ * @return true se SF o potenza sono cambiati
+ */
+bool lora_adr_on_ack(struct lora_adr *adr, const uint8_t *payload, int len, int8_t snr);
+
+/**
+ * @brief Aggiorna l'ADR dopo una finestra RX senza ACK
+ *
+ * @return true se SF o potenza sono cambiati
+ */
+bool lora_adr_on_loss(struct lora_adr *adr);
+
+/**
+ * @brief SNR minimo demodulabile per uno spreading factor, in decimi di dB
+ */
+int16_t lora_adr_required_snr(uint8_t sf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LORA_ADR_H_
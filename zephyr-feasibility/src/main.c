@@ -11,6 +11,18 @@
 #include <zephyr/random/random.h>
 #include <zephyr/drivers/lora.h>
 #include <stdio.h>
+#include <string.h>
+
+#include "payload.h"
+#include "telemetry.h"
+
+#ifdef CONFIG_APP_LORA_ADR
+#include "lora_adr.h"
+#endif
+
+#ifdef CONFIG_APP_FRAME_AUTH
+#include "frame_auth.h"
+#endif
 
 #ifdef CONFIG_EMUL
 #include "sensirion_sht3xd_emul.h"
@@ -18,13 +30,11 @@
 #include "sx1262_emul.h"
 #endif
 
-LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 
 // -----------------------------------------------------------------------------
 // Constants and thread configuration
 
-#define STACK_SIZE 1024
-
 #define LED_PRIORITY    5
 #define TEMP_PRIORITY   5
 #define LIGHT_PRIORITY  5
@@ -55,23 +65,52 @@ static const struct device *bh1750_dev = DEVICE_DT_GET(BH1750_NODE);
 static const struct i2c_dt_spec bh1750_spec = I2C_DT_SPEC_GET(BH1750_NODE);
 
 // -----------------------------------------------------------------------------
-// LoRa driver
+// LoRa driver (API lora_* di Zephyr, driver upstream SX126x)
+
 #define SX1262_NODE DT_NODELABEL(sx1262)
 static const struct device *sx1262_dev = DEVICE_DT_GET(SX1262_NODE);
 
+static struct lora_modem_config lora_cfg = {
+    .frequency = 868100000,
+    .bandwidth = BW_125_KHZ,
+    .datarate = SF_10,
+    .coding_rate = CR_4_5,
+    .preamble_len = 8,
+    .tx_power = 14,
+    .iq_inverted = false,
+    .public_network = false,
+    .tx = true,
+};
+
+#ifdef CONFIG_APP_LORA_ADR
+static struct lora_adr adr;
+#endif
+
 // -----------------------------------------------------------------------------
 // Thread stacks and control blocks
 
-K_THREAD_STACK_DEFINE(led_stack, STACK_SIZE);
-K_THREAD_STACK_DEFINE(temp_stack, STACK_SIZE);
-K_THREAD_STACK_DEFINE(light_stack, STACK_SIZE);
-K_THREAD_STACK_DEFINE(lora_stack, STACK_SIZE);
+K_THREAD_STACK_DEFINE(led_stack, CONFIG_APP_LED_STACK_SIZE);
+K_THREAD_STACK_DEFINE(temp_stack, CONFIG_APP_TEMP_STACK_SIZE);
+K_THREAD_STACK_DEFINE(light_stack, CONFIG_APP_LIGHT_STACK_SIZE);
+K_THREAD_STACK_DEFINE(lora_stack, CONFIG_APP_LORA_STACK_SIZE);
 
 static struct k_thread led_thread_data;
 static struct k_thread temp_thread_data;
 static struct k_thread light_thread_data;
 static struct k_thread lora_thread_data;
 
+// -----------------------------------------------------------------------------
+// Lettura sensore con misura della latenza per la telemetria
+
+static int sensor_fetch_timed(const struct device *dev, enum telemetry_sensor id)
+{
+    uint32_t start = telemetry_now();
+    int ret = sensor_sample_fetch(dev);
+
+    telemetry_fetch_time(id, start);
+    return ret;
+}
+
 // -----------------------------------------------------------------------------
 // LED Thread: toggles the LED periodically
 
@@ -82,8 +121,8 @@ void led_thread(void *arg1, void *arg2, void *arg3)
     while (1) {
         state = !state;
         gpio_pin_set_dt(&led, state);
-        LOG_INF("LED: %s", state ? "ON" : "OFF");
-        k_msleep(LED_BLINK_INTERVAL_MS);
+        LOG_DBG("LED: %s", state ? "ON" : "OFF");
+        telemetry_sleep(TELEMETRY_THREAD_LED, LED_BLINK_INTERVAL_MS);
     }
 }
 
@@ -95,7 +134,7 @@ void temp_thread(void *arg1, void *arg2, void *arg3)
     struct sensor_value temp, hum;
 
     while (1) {
-        if (sensor_sample_fetch(sht3xd_dev) == 0 &&
+        if (sensor_fetch_timed(sht3xd_dev, TELEMETRY_SENSOR_SHT3XD) == 0 &&
             sensor_channel_get(sht3xd_dev, SENSOR_CHAN_AMBIENT_TEMP, &temp) == 0 &&
             sensor_channel_get(sht3xd_dev, SENSOR_CHAN_HUMIDITY, &hum) == 0) {
 
@@ -106,7 +145,7 @@ void temp_thread(void *arg1, void *arg2, void *arg3)
             LOG_WRN("Failed to fetch SHT3XD sample");
         }
 
-        k_msleep(TEMP_INTERVAL_MS);
+        telemetry_sleep(TELEMETRY_THREAD_TEMP, TEMP_INTERVAL_MS);
     }
 }
 
@@ -128,7 +167,7 @@ void light_thread(void *arg1, void *arg2, void *arg3)
     }
 
     while (1) {
-        if (sensor_sample_fetch(bh1750_dev) == 0 &&
+        if (sensor_fetch_timed(bh1750_dev, TELEMETRY_SENSOR_BH1750) == 0 &&
             sensor_channel_get(bh1750_dev, SENSOR_CHAN_LIGHT, &lux) == 0) {
 
             float lf = sensor_value_to_double(&lux);
@@ -137,41 +176,151 @@ void light_thread(void *arg1, void *arg2, void *arg3)
             LOG_WRN("Failed to fetch BH1750 sample");
         }
 
-        k_msleep(LIGHT_INTERVAL_MS);
+        telemetry_sleep(TELEMETRY_THREAD_LIGHT, LIGHT_INTERVAL_MS);
+    }
+}
+
+#ifdef CONFIG_APP_LORA_ADR
+// -----------------------------------------------------------------------------
+// Finestra RX dopo l'uplink: l'ACK del gateway (o la sua assenza) guida l'ADR
+
+static void lora_adr_window(void)
+{
+    uint8_t ack[8];
+    int16_t rssi;
+    int8_t snr;
+    bool changed;
+    uint32_t start;
+    int len;
+
+    lora_cfg.tx = false;
+    if (lora_config(sx1262_dev, &lora_cfg) < 0) {
+        LOG_ERR("LoRa RX config failed");
+        len = -EIO;
+    } else {
+        start = telemetry_now();
+        len = lora_recv(sx1262_dev, ack, sizeof(ack),
+                        K_MSEC(CONFIG_APP_LORA_RX_WINDOW_MS), &rssi, &snr);
+        telemetry_radio_time(TELEMETRY_RADIO_RX, start);
+    }
+
+    if (len > 0) {
+        LOG_DBG("LoRa ACK: %d bytes, RSSI %d dBm, SNR %d dB", len, rssi, snr);
+        changed = lora_adr_on_ack(&adr, ack, len, snr);
+    } else {
+        LOG_WRN("LoRa ACK missing (%d)", len);
+        changed = lora_adr_on_loss(&adr);
+    }
+
+    if (changed) {
+        LOG_INF("ADR: SF%u, %d dBm", adr.sf, adr.tx_power);
+    }
+
+    lora_cfg.datarate = adr.sf;
+    lora_cfg.tx_power = adr.tx_power;
+    lora_cfg.tx = true;
+    if (lora_config(sx1262_dev, &lora_cfg) < 0) {
+        LOG_ERR("LoRa TX config failed");
     }
 }
+#endif
+
+// -----------------------------------------------------------------------------
+// Uplink LoRa con misura del tempo di occupazione della radio
+
+static int lora_send_timed(uint8_t *data, uint32_t len)
+{
+    uint32_t start = telemetry_now();
+    int ret = lora_send(sx1262_dev, data, len);
+
+    telemetry_radio_time(TELEMETRY_RADIO_TX, start);
+    return ret;
+}
+
+// Frame di salute ogni CONFIG_APP_TELEMETRY_HEALTH_INTERVAL_H ore
+static void lora_health_uplink(void)
+{
+    uint8_t frame[TELEMETRY_HEALTH_LEN];
+    int len;
+    int ret;
+
+    if (!telemetry_health_due()) {
+        return;
+    }
+
+    len = telemetry_health_encode(frame, sizeof(frame));
+    if (len <= 0) {
+        LOG_ERR("Health frame encode failed: %d", len);
+        return;
+    }
+
+    ret = lora_send_timed(frame, len);
+    if (ret == 0) {
+        LOG_INF("LoRa TX: health frame (%d bytes)", len);
+    } else {
+        LOG_ERR("Health frame send failed: %d", ret);
+    }
+}
+
+#ifdef CONFIG_APP_FRAME_AUTH
+// Una trama autenticata ogni CONFIG_APP_FRAME_AUTH_BATCH letture
+static struct frame_auth_batch batch;
+
+static int uplink_encode(uint8_t *buf, size_t size, const struct sensor_value *temp,
+                         const struct sensor_value *hum, const struct sensor_value *lux)
+{
+    if (!frame_auth_add(&batch, temp, hum, lux)) {
+        return 0;  // Batch non ancora pieno
+    }
+    return frame_auth_seal(&batch, buf, size);
+}
+#define UPLINK_MAX_LEN FRAME_AUTH_MAX_LEN
+#else
+static int uplink_encode(uint8_t *buf, size_t size, const struct sensor_value *temp,
+                         const struct sensor_value *hum, const struct sensor_value *lux)
+{
+    return payload_encode((char *)buf, size, temp, hum, lux);
+}
+#define UPLINK_MAX_LEN 64
+#endif
 
 void lora_thread(void *arg1, void *arg2, void *arg3)
 {
     struct sensor_value temp, hum, lux;
-    char payload[64];
+    uint8_t payload[UPLINK_MAX_LEN];
 
     while (1) {
-        bool ok = sensor_sample_fetch(sht3xd_dev) == 0 &&
+        bool ok = sensor_fetch_timed(sht3xd_dev, TELEMETRY_SENSOR_SHT3XD) == 0 &&
                   sensor_channel_get(sht3xd_dev, SENSOR_CHAN_AMBIENT_TEMP, &temp) == 0 &&
                   sensor_channel_get(sht3xd_dev, SENSOR_CHAN_HUMIDITY, &hum) == 0 &&
-                  sensor_sample_fetch(bh1750_dev) == 0 &&
+                  sensor_fetch_timed(bh1750_dev, TELEMETRY_SENSOR_BH1750) == 0 &&
                   sensor_channel_get(bh1750_dev, SENSOR_CHAN_LIGHT, &lux) == 0;
 
-        if (ok) {
-            float tf = sensor_value_to_double(&temp);
-            float hf = sensor_value_to_double(&hum);
-            float lf = sensor_value_to_double(&lux);
+        int len = ok ? uplink_encode(payload, sizeof(payload), &temp, &hum, &lux) : -EIO;
 
-            snprintf(payload, sizeof(payload), "T:%.1f H:%.1f L:%.1f", (double)tf, (double)hf, (double)lf);
-            //LOG_INF("T: %.1f H: %.1f L: %.1f", (double)tf, (double)hf, (double)lf);
-
-            int ret = sx1262_send(sx1262_dev, (uint8_t *)payload, strlen(payload));
+        if (len > 0) {
+            int ret = lora_send_timed(payload, len);
             if (ret == 0) {
-                LOG_INF("LoRa TX: %s", payload);
+#ifdef CONFIG_APP_FRAME_AUTH
+                LOG_INF("LoRa TX: frame %u (%d bytes)", frame_auth_counter() - 1, len);
+#else
+                LOG_INF("LoRa TX: %s", (char *)payload);
+#endif
+#ifdef CONFIG_APP_LORA_ADR
+                lora_adr_window();
+#endif
             } else {
                 LOG_ERR("LoRa send failed: %d", ret);
             }
-        } else {
+        } else if (!ok) {
             LOG_WRN("Sensor read failed");
+        } else if (len < 0) {
+            LOG_ERR("Payload encode failed: %d", len);
         }
 
-        k_msleep(LORA_INTERVAL_MS);  // invia ogni 5 secondi
+        lora_health_uplink();
+
+        telemetry_sleep(TELEMETRY_THREAD_LORA, LORA_INTERVAL_MS);  // invia ogni 5 secondi
     }
 }
 
@@ -203,6 +352,24 @@ int main(void)
         return 0;
     }
 
+#ifdef CONFIG_APP_LORA_ADR
+    lora_adr_init(&adr, lora_cfg.datarate, lora_cfg.tx_power);
+    lora_cfg.datarate = adr.sf;
+    lora_cfg.tx_power = adr.tx_power;
+#endif
+
+    if (lora_config(sx1262_dev, &lora_cfg) < 0) {
+        LOG_ERR("LoRa config failed");
+        return 0;
+    }
+
+#ifdef CONFIG_APP_FRAME_AUTH
+    if (frame_auth_init() < 0) {
+        LOG_ERR("Frame authentication init failed");
+        return 0;
+    }
+#endif
+
     // Configure LED pin
     if (gpio_pin_configure_dt(&led, GPIO_OUTPUT_ACTIVE) < 0) {
         LOG_ERR("Failed to configure LED GPIO");
@@ -212,22 +379,29 @@ int main(void)
     LOG_INF("Devices ready. Launching threads...");
 
     // Start threads
-    k_thread_create(&led_thread_data, led_stack, STACK_SIZE,
+    k_thread_create(&led_thread_data, led_stack, K_THREAD_STACK_SIZEOF(led_stack),
                     led_thread, NULL, NULL, NULL,
                     LED_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&led_thread_data, "led");
+    telemetry_thread_register(TELEMETRY_THREAD_LED, &led_thread_data);
 
-    k_thread_create(&temp_thread_data, temp_stack, STACK_SIZE,
+    k_thread_create(&temp_thread_data, temp_stack, K_THREAD_STACK_SIZEOF(temp_stack),
                     temp_thread, NULL, NULL, NULL,
                     TEMP_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&temp_thread_data, "temp");
+    telemetry_thread_register(TELEMETRY_THREAD_TEMP, &temp_thread_data);
 
-    k_thread_create(&light_thread_data, light_stack, STACK_SIZE,
+    k_thread_create(&light_thread_data, light_stack, K_THREAD_STACK_SIZEOF(light_stack),
                     light_thread, NULL, NULL, NULL,
                     LIGHT_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&light_thread_data, "light");
+    telemetry_thread_register(TELEMETRY_THREAD_LIGHT, &light_thread_data);
 
-    k_thread_create(&lora_thread_data, lora_stack, STACK_SIZE,
+    k_thread_create(&lora_thread_data, lora_stack, K_THREAD_STACK_SIZEOF(lora_stack),
                     lora_thread, NULL, NULL, NULL,
                     LORA_PRIORITY, 0, K_NO_WAIT);
-    
+    k_thread_name_set(&lora_thread_data, "lora");
+    telemetry_thread_register(TELEMETRY_THREAD_LORA, &lora_thread_data);
 
     return 0;
 }
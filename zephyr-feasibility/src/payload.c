@@ -0,0 +1,34 @@
+// -----------------------------------------------------------------------------
+// Codifica del payload di uplink
+// -----------------------------------------------------------------------------
+
+#include "payload.h"
+#include "hot_path.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Decimi arrotondati di un sensor_value in virgola fissa: niente double
+// (soft-float sull'ESP32-S3) e niente printf con supporto float nell'immagine
+APP_HOT int32_t payload_tenths(const struct sensor_value *v)
+{
+	int64_t micro = (int64_t)v->val1 * 1000000 + v->val2;
+
+	return (int32_t)((micro + (micro < 0 ? -50000 : 50000)) / 100000);
+}
+
+int payload_encode(char *buf, size_t size, const struct sensor_value *temp,
+		   const struct sensor_value *hum, const struct sensor_value *lux)
+{
+	int32_t t = payload_tenths(temp), h = payload_tenths(hum), l = payload_tenths(lux);
+	int len = snprintf(buf, size, "T:%s%d.%d H:%s%d.%d L:%s%d.%d",
+			   t < 0 ? "-" : "", abs(t) / 10, abs(t) % 10,
+			   h < 0 ? "-" : "", abs(h) / 10, abs(h) % 10,
+			   l < 0 ? "-" : "", abs(l) / 10, abs(l) % 10);
+
+	if (len < 0 || (size_t)len >= size) {
+		return -ENOSPC;
+	}
+	return len;
+}
@@ -0,0 +1,30 @@
+// Codifica del payload di uplink a partire dalle letture dei sensori.
+#ifndef PAYLOAD_H_
+#define PAYLOAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/drivers/sensor.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Decimi arrotondati di un sensor_value, senza passare per i double
+ */
+int32_t payload_tenths(const struct sensor_value *v);
+
+/**
+ * @brief Codifica una lettura nel formato testuale "T:%.1f H:%.1f L:%.1f"
+ *
+ * @return lunghezza del payload, -ENOSPC se buf e' troppo piccolo
+ */
+int payload_encode(char *buf, size_t size, const struct sensor_value *temp,
+		   const struct sensor_value *hum, const struct sensor_value *lux);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PAYLOAD_H_
@@ -0,0 +1,258 @@
+// -----------------------------------------------------------------------------
+// Telemetria del nodo
+//
+// Le statistiche coprono l'intervallo dall'ultimo frame di salute (o dal
+// reset da shell): CPU per thread dalle runtime stats del kernel, istogrammi
+// log2 del ritardo dei risvegli e della latenza delle letture sensore, tempo
+// di occupazione della radio in TX e RX.
+// -----------------------------------------------------------------------------
+
+#include "telemetry.h"
+#include "hot_path.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+
+#ifdef CONFIG_APP_TELEMETRY_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+
+struct telemetry_hist {
+	uint32_t bucket[TELEMETRY_HIST_BUCKETS];
+	uint32_t count;
+	uint32_t max_us;
+};
+
+static const char *const thread_names[TELEMETRY_THREAD_COUNT] = {
+	"led", "temp", "light", "lora",
+};
+
+static const char *const sensor_names[TELEMETRY_SENSOR_COUNT] = {
+	"sht3xd", "bh1750",
+};
+
+static struct {
+	struct k_spinlock lock;
+	k_tid_t tid[TELEMETRY_THREAD_COUNT];
+	uint64_t cycles_ref[TELEMETRY_THREAD_COUNT];
+	struct telemetry_hist lateness[TELEMETRY_THREAD_COUNT];
+	struct telemetry_hist fetch[TELEMETRY_SENSOR_COUNT];
+	uint64_t radio_us[TELEMETRY_RADIO_COUNT];
+	int64_t since_ticks;
+	int64_t next_health_ms;
+} tm;
+
+static uint32_t cyc_since_us(uint32_t start)
+{
+	return k_cyc_to_us_floor32(k_cycle_get_32() - start);
+}
+
+APP_HOT static void hist_add(struct telemetry_hist *h, uint32_t us)
+{
+	unsigned int i = us ? MIN(LOG2(us), TELEMETRY_HIST_BUCKETS - 1) : 0;
+	k_spinlock_key_t key = k_spin_lock(&tm.lock);
+
+	h->bucket[i]++;
+	h->count++;
+	h->max_us = MAX(h->max_us, us);
+
+	k_spin_unlock(&tm.lock, key);
+}
+
+// Bucket che contiene il percentile richiesto (0xFF se vuoto)
+static uint8_t hist_percentile(const struct telemetry_hist *h, unsigned int pct)
+{
+	uint32_t target = DIV_ROUND_UP(h->count * pct, 100);
+	uint32_t sum = 0;
+
+	if (h->count == 0) {
+		return 0xFF;
+	}
+	for (unsigned int i = 0; i < TELEMETRY_HIST_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (sum >= target) {
+			return i;
+		}
+	}
+	return TELEMETRY_HIST_BUCKETS - 1;
+}
+
+static uint64_t thread_cycles(enum telemetry_thread id)
+{
+	k_thread_runtime_stats_t stats;
+
+	if (tm.tid[id] == NULL || k_thread_runtime_stats_get(tm.tid[id], &stats) != 0) {
+		return 0;
+	}
+	return stats.execution_cycles;
+}
+
+// CPU del thread nell'intervallo, in decimi di percento
+static uint32_t thread_cpu_permille(enum telemetry_thread id)
+{
+	uint64_t elapsed = k_ticks_to_cyc_floor64(k_uptime_ticks() - tm.since_ticks);
+
+	if (elapsed == 0) {
+		return 0;
+	}
+	return (uint32_t)(((thread_cycles(id) - tm.cycles_ref[id]) * 1000U) / elapsed);
+}
+
+void telemetry_thread_register(enum telemetry_thread id, k_tid_t tid)
+{
+	tm.tid[id] = tid;
+	tm.cycles_ref[id] = thread_cycles(id);
+}
+
+void telemetry_sleep(enum telemetry_thread id, int32_t ms)
+{
+	int64_t expected = k_uptime_ticks() + k_ms_to_ticks_ceil64(ms);
+
+	k_msleep(ms);
+
+	hist_add(&tm.lateness[id],
+		 (uint32_t)k_ticks_to_us_floor64(MAX(k_uptime_ticks() - expected, 0)));
+}
+
+void telemetry_fetch_time(enum telemetry_sensor id, uint32_t start)
+{
+	hist_add(&tm.fetch[id], cyc_since_us(start));
+}
+
+void telemetry_radio_time(enum telemetry_radio id, uint32_t start)
+{
+	uint32_t us = cyc_since_us(start);
+	k_spinlock_key_t key = k_spin_lock(&tm.lock);
+
+	tm.radio_us[id] += us;
+
+	k_spin_unlock(&tm.lock, key);
+}
+
+void telemetry_reset(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&tm.lock);
+
+	memset(tm.lateness, 0, sizeof(tm.lateness));
+	memset(tm.fetch, 0, sizeof(tm.fetch));
+	memset(tm.radio_us, 0, sizeof(tm.radio_us));
+	tm.since_ticks = k_uptime_ticks();
+
+	k_spin_unlock(&tm.lock, key);
+
+	for (int i = 0; i < TELEMETRY_THREAD_COUNT; i++) {
+		tm.cycles_ref[i] = thread_cycles(i);
+	}
+}
+
+bool telemetry_health_due(void)
+{
+	if (CONFIG_APP_TELEMETRY_HEALTH_INTERVAL_H == 0) {
+		return false;
+	}
+	if (tm.next_health_ms == 0) {
+		tm.next_health_ms = CONFIG_APP_TELEMETRY_HEALTH_INTERVAL_H * 3600LL * 1000LL;
+	}
+	return k_uptime_get() >= tm.next_health_ms;
+}
+
+int telemetry_health_encode(uint8_t *buf, size_t size)
+{
+	uint8_t *p = buf;
+
+	if (size < TELEMETRY_HEALTH_LEN) {
+		return -ENOSPC;
+	}
+
+	*p++ = TELEMETRY_HEALTH_TYPE;
+	*p++ = TELEMETRY_HEALTH_VERSION;
+	sys_put_le32((uint32_t)(k_uptime_get() / 1000), p);
+	p += 4;
+
+	for (int i = 0; i < TELEMETRY_THREAD_COUNT; i++) {
+		*p++ = (uint8_t)MIN(thread_cpu_permille(i) / 5, UINT8_MAX);
+	}
+	for (int i = 0; i < TELEMETRY_THREAD_COUNT; i++) {
+		*p++ = hist_percentile(&tm.lateness[i], 99);
+	}
+	for (int i = 0; i < TELEMETRY_SENSOR_COUNT; i++) {
+		*p++ = hist_percentile(&tm.fetch[i], 99);
+	}
+	for (int i = 0; i < TELEMETRY_RADIO_COUNT; i++) {
+		sys_put_le16((uint16_t)MIN(tm.radio_us[i] / 100000U, UINT16_MAX), p);
+		p += 2;
+	}
+
+	tm.next_health_ms = k_uptime_get() + CONFIG_APP_TELEMETRY_HEALTH_INTERVAL_H * 3600LL * 1000LL;
+	telemetry_reset();
+
+	return p - buf;
+}
+
+#ifdef CONFIG_APP_TELEMETRY_SHELL
+// -----------------------------------------------------------------------------
+// Comando shell "telemetry"
+
+static void shell_hist(const struct shell *sh, const char *name, const struct telemetry_hist *h)
+{
+	shell_fprintf(sh, SHELL_NORMAL, "  %-8s n=%-6u max=%uus p50<%uus p99<%uus |", name,
+		      h->count, h->max_us, 2U << MIN(hist_percentile(h, 50), 30),
+		      2U << MIN(hist_percentile(h, 99), 30));
+	for (int i = 0; i < TELEMETRY_HIST_BUCKETS; i++) {
+		shell_fprintf(sh, SHELL_NORMAL, " %u", h->bucket[i]);
+	}
+	shell_fprintf(sh, SHELL_NORMAL, "\n");
+}
+
+static int cmd_telemetry_show(const struct shell *sh, size_t argc, char **argv)
+{
+	uint32_t permille;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	shell_print(sh, "Interval: %llu s",
+		    (unsigned long long)k_ticks_to_ms_floor64(k_uptime_ticks() - tm.since_ticks) / 1000);
+
+	shell_print(sh, "CPU:");
+	for (int i = 0; i < TELEMETRY_THREAD_COUNT; i++) {
+		permille = thread_cpu_permille(i);
+		shell_print(sh, "  %-8s %u.%u%%", thread_names[i], permille / 10, permille % 10);
+	}
+
+	shell_print(sh, "Wakeup lateness (log2 us buckets):");
+	for (int i = 0; i < TELEMETRY_THREAD_COUNT; i++) {
+		shell_hist(sh, thread_names[i], &tm.lateness[i]);
+	}
+
+	shell_print(sh, "Sensor fetch latency (log2 us buckets):");
+	for (int i = 0; i < TELEMETRY_SENSOR_COUNT; i++) {
+		shell_hist(sh, sensor_names[i], &tm.fetch[i]);
+	}
+
+	shell_print(sh, "Radio busy: TX %llu ms, RX %llu ms",
+		    (unsigned long long)tm.radio_us[TELEMETRY_RADIO_TX] / 1000,
+		    (unsigned long long)tm.radio_us[TELEMETRY_RADIO_RX] / 1000);
+	return 0;
+}
+
+static int cmd_telemetry_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	telemetry_reset();
+	shell_print(sh, "Telemetry reset");
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(telemetry_cmds,
+	SHELL_CMD(show, NULL, "Show CPU, lateness, fetch and radio stats", cmd_telemetry_show),
+	SHELL_CMD(reset, NULL, "Reset the current interval", cmd_telemetry_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(telemetry, &telemetry_cmds, "Node telemetry", NULL);
+#endif // CONFIG_APP_TELEMETRY_SHELL
@@ -0,0 +1,114 @@
+// Telemetria del nodo: CPU per thread, ritardo dei risvegli, latenza delle
+// letture sensore e tempo di occupazione della radio.
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum telemetry_thread {
+	TELEMETRY_THREAD_LED,
+	TELEMETRY_THREAD_TEMP,
+	TELEMETRY_THREAD_LIGHT,
+	TELEMETRY_THREAD_LORA,
+	TELEMETRY_THREAD_COUNT,
+};
+
+enum telemetry_sensor {
+	TELEMETRY_SENSOR_SHT3XD,
+	TELEMETRY_SENSOR_BH1750,
+	TELEMETRY_SENSOR_COUNT,
+};
+
+enum telemetry_radio {
+	TELEMETRY_RADIO_TX,
+	TELEMETRY_RADIO_RX,
+	TELEMETRY_RADIO_COUNT,
+};
+
+// Istogrammi log2 in microsecondi: il bucket i conta i valori in [2^i, 2^(i+1))
+#define TELEMETRY_HIST_BUCKETS 16
+
+// Frame di salute in uplink (little-endian):
+// [0xFE, versione, uptime_s u32, cpu[4] (0.5%), ritardo p99[4] (log2 us),
+//  fetch p99[2] (log2 us), radio TX u16 (ds), radio RX u16 (ds)]
+#define TELEMETRY_HEALTH_TYPE    0xFE
+#define TELEMETRY_HEALTH_VERSION 1
+#define TELEMETRY_HEALTH_LEN     20
+
+static inline uint32_t telemetry_now(void)
+{
+	return k_cycle_get_32();
+}
+
+#ifdef CONFIG_APP_TELEMETRY
+
+/**
+ * @brief Associa un thread dell'app al suo slot per le runtime stats
+ */
+void telemetry_thread_register(enum telemetry_thread id, k_tid_t tid);
+
+/**
+ * @brief k_msleep() che registra il ritardo del risveglio rispetto al previsto
+ */
+void telemetry_sleep(enum telemetry_thread id, int32_t ms);
+
+/**
+ * @brief Registra la durata di una lettura sensore iniziata a start (cicli)
+ */
+void telemetry_fetch_time(enum telemetry_sensor id, uint32_t start);
+
+/**
+ * @brief Somma al tempo di occupazione della radio un'operazione iniziata a start
+ */
+void telemetry_radio_time(enum telemetry_radio id, uint32_t start);
+
+/**
+ * @brief true quando e' ora di inviare il frame di salute
+ */
+bool telemetry_health_due(void);
+
+/**
+ * @brief Codifica il frame di salute e azzera le statistiche dell'intervallo
+ *
+ * @return TELEMETRY_HEALTH_LEN, -ENOSPC se buf e' troppo piccolo
+ */
+int telemetry_health_encode(uint8_t *buf, size_t size);
+
+/**
+ * @brief Azzera istogrammi, contatori e riferimenti di CPU
+ */
+void telemetry_reset(void);
+
+#else
+
+static inline void telemetry_thread_register(enum telemetry_thread id, k_tid_t tid) {}
+static inline void telemetry_sleep(enum telemetry_thread id, int32_t ms)
+{
+	k_msleep(ms);
+}
+static inline void telemetry_fetch_time(enum telemetry_sensor id, uint32_t start) {}
+static inline void telemetry_radio_time(enum telemetry_radio id, uint32_t start) {}
+static inline bool telemetry_health_due(void)
+{
+	return false;
+}
+static inline int telemetry_health_encode(uint8_t *buf, size_t size)
+{
+	return -ENOTSUP;
+}
+static inline void telemetry_reset(void) {}
+
+#endif // CONFIG_APP_TELEMETRY
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_H_
@@ -0,0 +1,9 @@
+// Orologio del benchmark: tempo CPU dell'host (la suite gira solo su native_sim)
+
+#include "bench_clock.h"
+#include "bench_clock_bottom.h"
+
+uint64_t bench_clock_ns(void)
+{
+	return bench_host_cpu_ns();
+}
@@ -0,0 +1,11 @@
+// Orologio per le misure di costo del benchmark.
+#ifndef BENCH_CLOCK_H_
+#define BENCH_CLOCK_H_
+
+#include <stdint.h>
+
+// Nanosecondi di CPU: tempo di processo dell'host native_sim (il tempo
+// simulato e' fermo mentre il codice gira)
+uint64_t bench_clock_ns(void);
+
+#endif // BENCH_CLOCK_H_
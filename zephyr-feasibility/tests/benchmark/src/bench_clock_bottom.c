@@ -0,0 +1,15 @@
+// Lato host dell'orologio del benchmark (compilato nel native_simulator)
+
+#include "bench_clock_bottom.h"
+
+#include <time.h>
+
+uint64_t bench_host_cpu_ns(void)
+{
+	struct timespec ts;
+
+	// Un solo thread Zephyr alla volta gira sull'host: il tempo del
+	// processo e' il costo del codice eseguito
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,10 @@
+// Lato host dell'orologio del benchmark (compilato nel native_simulator).
+#ifndef BENCH_CLOCK_BOTTOM_H_
+#define BENCH_CLOCK_BOTTOM_H_
+
+#include <stdint.h>
+
+// Tempo CPU consumato dal processo native_sim, in ns
+uint64_t bench_host_cpu_ns(void);
+
+#endif // BENCH_CLOCK_BOTTOM_H_
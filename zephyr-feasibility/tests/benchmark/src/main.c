@@ -0,0 +1,264 @@
+// -----------------------------------------------------------------------------
+// Benchmark del firmware VitiMonitor
+//
+// bench_micro misura il costo delle singole operazioni (acquisizione, encode,
+// trama autenticata, lora_send). bench_system avvia l'app completa tramite app_main(), la lascia
+// girare BENCH_RUN_S secondi simulati e conta risvegli dall'idle e tempo CPU.
+// Niente stack high-water: su native_sim i thread girano sugli stack dei
+// pthread dell'host (sul target si misura con stack_report.conf). Ogni
+// risultato e' una riga "BENCH <metrica> <valore>" che utils/bench_report.py
+// confronta con thresholds.json.
+// -----------------------------------------------------------------------------
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/lora.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/ztest.h>
+#include <tracing_user.h>
+
+#include "bench_clock.h"
+#include "payload.h"
+
+#ifdef CONFIG_APP_FRAME_AUTH
+#include "frame_auth.h"
+#endif
+
+LOG_MODULE_REGISTER(bench, LOG_LEVEL_INF);
+
+// main() del firmware, rinominata da CMakeLists.txt
+int app_main(void);
+
+#define BENCH_ITERATIONS       200
+#define BENCH_LORA_ITERATIONS  10
+#define BENCH_LOG_ITERATIONS   50
+#define BENCH_RUN_S            120
+
+#define BH1750_NODE DT_NODELABEL(bh1750)
+
+static const struct device *sht3xd_dev = DEVICE_DT_GET(DT_NODELABEL(sht3xd));
+static const struct device *bh1750_dev = DEVICE_DT_GET(BH1750_NODE);
+static const struct i2c_dt_spec bh1750_spec = I2C_DT_SPEC_GET(BH1750_NODE);
+static const struct device *sx1262_dev = DEVICE_DT_GET(DT_NODELABEL(sx1262));
+
+// -----------------------------------------------------------------------------
+// Statistiche di tempo
+
+struct bench_stat {
+	uint64_t sum;
+	uint64_t max;
+	uint32_t n;
+	uint64_t start;
+};
+
+static inline void bench_begin(struct bench_stat *s)
+{
+	s->start = bench_clock_ns();
+}
+
+static inline void bench_end(struct bench_stat *s)
+{
+	uint64_t ns = bench_clock_ns() - s->start;
+
+	s->sum += ns;
+	s->max = MAX(s->max, ns);
+	s->n++;
+}
+
+static void bench_print(const char *name, const struct bench_stat *s)
+{
+	printk("BENCH %s.mean_ns %llu\n", name, (unsigned long long)(s->sum / MAX(s->n, 1U)));
+	printk("BENCH %s.max_ns %llu\n", name, (unsigned long long)s->max);
+}
+
+// -----------------------------------------------------------------------------
+// Risvegli: ogni uscita dall'idle (ISR o cambio di thread) conta come uno
+
+static volatile uint32_t wakeups;
+static volatile bool in_idle;
+
+void sys_trace_idle_user(void)
+{
+	in_idle = true;
+}
+
+static inline void bench_wakeup(void)
+{
+	if (in_idle) {
+		in_idle = false;
+		wakeups++;
+	}
+}
+
+void sys_trace_isr_enter_user(int nested_interrupts)
+{
+	ARG_UNUSED(nested_interrupts);
+	bench_wakeup();
+}
+
+void sys_trace_thread_switched_in_user(void)
+{
+	bench_wakeup();
+}
+
+// -----------------------------------------------------------------------------
+// bench_micro: costo delle singole operazioni
+
+static void *bench_setup(void)
+{
+	uint8_t power_on_cmd = 0x01;
+
+	zassert_true(device_is_ready(sht3xd_dev), "SHT3XD not ready");
+	zassert_true(device_is_ready(bh1750_dev), "BH1750 not ready");
+	zassert_true(device_is_ready(sx1262_dev), "SX1262 not ready");
+	zassert_ok(i2c_write_dt(&bh1750_spec, &power_on_cmd, 1));
+#ifdef CONFIG_APP_FRAME_AUTH
+	zassert_ok(frame_auth_init());
+#endif
+
+	return NULL;
+}
+
+ZTEST(bench_micro, test_acquisition)
+{
+	struct sensor_value temp, hum, lux;
+	struct bench_stat sht = { 0 };
+	struct bench_stat bh = { 0 };
+
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		bench_begin(&sht);
+		zassert_ok(sensor_sample_fetch(sht3xd_dev));
+		zassert_ok(sensor_channel_get(sht3xd_dev, SENSOR_CHAN_AMBIENT_TEMP, &temp));
+		zassert_ok(sensor_channel_get(sht3xd_dev, SENSOR_CHAN_HUMIDITY, &hum));
+		bench_end(&sht);
+
+		bench_begin(&bh);
+		zassert_ok(sensor_sample_fetch(bh1750_dev));
+		zassert_ok(sensor_channel_get(bh1750_dev, SENSOR_CHAN_LIGHT, &lux));
+		bench_end(&bh);
+	}
+
+	bench_print("acquisition.sht3xd", &sht);
+	bench_print("acquisition.bh1750", &bh);
+}
+
+ZTEST(bench_micro, test_encode)
+{
+	struct sensor_value temp = { .val1 = 23, .val2 = 450000 };
+	struct sensor_value hum = { .val1 = 61, .val2 = 200000 };
+	struct sensor_value lux = { .val1 = 15234, .val2 = 500000 };
+	struct bench_stat enc = { 0 };
+	char payload[64];
+	int len = 0;
+
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		bench_begin(&enc);
+		len = payload_encode(payload, sizeof(payload), &temp, &hum, &lux);
+		bench_end(&enc);
+	}
+
+	zassert_true(len > 0, "encode failed: %d", len);
+	bench_print("encode", &enc);
+	printk("BENCH encode.bytes %d\n", len);
+}
+
+#ifdef CONFIG_APP_FRAME_AUTH
+ZTEST(bench_micro, test_frame_auth)
+{
+	struct sensor_value temp = { .val1 = 23, .val2 = 450000 };
+	struct sensor_value hum = { .val1 = 61, .val2 = 200000 };
+	struct sensor_value lux = { .val1 = 15234, .val2 = 500000 };
+	struct frame_auth_batch batch = { 0 };
+	struct bench_stat seal = { 0 };
+	uint8_t frame[FRAME_AUTH_MAX_LEN];
+	int len = 0;
+
+	// Un batch completo: codifica delle letture piu' un solo HMAC per trama
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		bench_begin(&seal);
+		for (int r = 0; r < CONFIG_APP_FRAME_AUTH_BATCH; r++) {
+			frame_auth_add(&batch, &temp, &hum, &lux);
+		}
+		len = frame_auth_seal(&batch, frame, sizeof(frame));
+		bench_end(&seal);
+	}
+
+	zassert_equal(len, FRAME_AUTH_MAX_LEN, "seal failed: %d", len);
+	bench_print("auth.frame", &seal);
+	printk("BENCH auth.frame.per_reading_ns %llu\n",
+	       (unsigned long long)(seal.sum / seal.n / CONFIG_APP_FRAME_AUTH_BATCH));
+	printk("BENCH auth.bytes_per_reading %d\n", len / CONFIG_APP_FRAME_AUTH_BATCH);
+}
+#endif
+
+ZTEST(bench_micro, test_log_hot_path)
+{
+	struct bench_stat inf = { 0 };
+	double temp = 23.45;
+	double hum = 61.2;
+
+	// Costo nel thread chiamante: formattazione (modo immediato) oppure
+	// solo accodamento dei parametri (deferred / dizionario)
+	for (int i = 0; i < BENCH_LOG_ITERATIONS; i++) {
+		bench_begin(&inf);
+		LOG_INF("Temp: %.2f °C, Humidity: %.2f %%", temp, hum);
+		bench_end(&inf);
+
+		// Lascia svuotare la coda al thread di log, fuori dalla misura
+		k_msleep(10);
+	}
+
+	bench_print("log.inf_float", &inf);
+}
+
+ZTEST(bench_micro, test_lora_send)
+{
+	struct lora_modem_config cfg = {
+		.frequency = 868100000,
+		.bandwidth = BW_125_KHZ,
+		.datarate = SF_7,
+		.coding_rate = CR_4_5,
+		.preamble_len = 8,
+		.tx_power = 14,
+		.tx = true,
+	};
+	uint8_t payload[24] = "T:23.4 H:61.2 L:15234.5";
+	struct bench_stat send = { 0 };
+
+	zassert_ok(lora_config(sx1262_dev, &cfg));
+
+	// Include l'attesa di TxDone, ma il time-on-air simulato non costa CPU
+	for (int i = 0; i < BENCH_LORA_ITERATIONS; i++) {
+		bench_begin(&send);
+		zassert_ok(lora_send(sx1262_dev, payload, sizeof(payload) - 1));
+		bench_end(&send);
+	}
+
+	bench_print("lora_send", &send);
+}
+
+ZTEST_SUITE(bench_micro, NULL, bench_setup, NULL, NULL, NULL);
+
+// -----------------------------------------------------------------------------
+// bench_system: firmware completo
+
+ZTEST(bench_system, test_app_run)
+{
+	uint64_t cpu;
+	uint32_t start;
+
+	zassert_ok(app_main());
+
+	start = wakeups;
+	cpu = bench_clock_ns();
+	k_sleep(K_SECONDS(BENCH_RUN_S));
+	cpu = bench_clock_ns() - cpu;
+
+	printk("BENCH wakeups_per_hour %u\n", (wakeups - start) * (3600 / BENCH_RUN_S));
+	printk("BENCH app.cpu_us_per_s %llu\n", (unsigned long long)(cpu / 1000 / BENCH_RUN_S));
+}
+
+ZTEST_SUITE(bench_system, NULL, NULL, NULL, NULL, NULL);
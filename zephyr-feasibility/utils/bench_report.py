@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Collect firmware benchmark results and check them against thresholds.
+
+Reads the "BENCH <metric> <value>" lines printed by tests/benchmark, adds
+ROM/RAM per module from the linker map file and writes everything to
+<build>/bench.json. Exits with status 1 when the test suite failed or a
+metric is outside its threshold, so `make bench` fails on regressions.
+
+thresholds.json maps metric names (fnmatch patterns allowed) to limits:
+
+    {"encode.mean_ns": {"max": 50000}, "acquisition.*.mean_ns": {"max": 200000}}
+"""
+
+import argparse
+import fnmatch
+import json
+import math
+import os
+import re
+import sys
+
+BENCH_RE = re.compile(r"BENCH (\S+) (-?\d+(?:\.\d+)?)")
+
+# Module = first pattern matching the archive/object of an input section
+MODULES = [
+    ("app", r"libapp\.a|/app/"),
+    ("sx1262_emul", r"sx1262_emul"),
+    ("sht3xd_emul", r"sht3xd_emul"),
+    ("bh1750_emul", r"bh1750_emul"),
+    ("lora", r"lora|loramac|sx126x"),
+    ("sensor", r"drivers__sensor"),
+    ("kernel", r"libkernel\.a"),
+    ("logging", r"logging"),
+    ("ztest", r"ztest|testsuite"),
+    ("libc", r"libc|picolibc|newlib|libgcc|libm\.a"),
+    ("arch", r"arch__|libarch|soc__|boards__|native_simulator"),
+    ("drivers", r"drivers__"),
+]
+
+# Sections that are not loaded on the target
+SKIP_SECTIONS = re.compile(r"^\.(debug|comment|note|stab|symtab|strtab|shstrtab|ARM\.attributes|xtensa\.info|gnu)")
+
+INPUT_RE = re.compile(r"^\s+(?:(\S+)\s+)?0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+\.(?:a|o|obj)\)?)\s*$")
+
+
+def parse_log(path):
+    metrics = {}
+    passed = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            m = BENCH_RE.search(line)
+            if m:
+                value = float(m.group(2))
+                metrics[m.group(1)] = int(value) if value.is_integer() else value
+            if "PROJECT EXECUTION SUCCESSFUL" in line:
+                passed = True
+            elif "PROJECT EXECUTION FAILED" in line:
+                passed = False
+    return metrics, passed
+
+
+def module_of(obj):
+    for name, pattern in MODULES:
+        if re.search(pattern, obj):
+            return name
+    return "other"
+
+
+def memory_kind(section):
+    # Approximation from the output section name, valid for native_sim
+    # and for the ESP32 layout (.iram0.text, .dram0.bss, .flash.rodata, ...)
+    if "bss" in section or "noinit" in section:
+        return "ram"
+    if ("data" in section and "rodata" not in section) or "iram" in section:
+        return "both"
+    return "rom"
+
+
+def parse_map(path):
+    rom, ram = {}, {}
+    in_memory_map = False
+    output_section = ""
+    pending_section = None
+
+    with open(path, errors="replace") as f:
+        for line in f:
+            if line.startswith("Linker script and memory map"):
+                in_memory_map = True
+                continue
+            if not in_memory_map:
+                continue
+
+            # Output section: starts in column 0
+            if line[:1] not in (" ", "\t", "\n", ""):
+                output_section = line.split()[0] if line.split() else ""
+                continue
+
+            m = INPUT_RE.match(line)
+            if not m:
+                # Long input section names are printed on their own line
+                stripped = line.strip()
+                pending_section = stripped if stripped.startswith(".") and " " not in stripped else None
+                continue
+
+            section = m.group(1) or pending_section or output_section
+            pending_section = None
+            size = int(m.group(3), 16)
+            if not size or SKIP_SECTIONS.match(output_section) or SKIP_SECTIONS.match(section):
+                continue
+
+            module = module_of(m.group(4))
+            kind = memory_kind(output_section or section)
+            if kind in ("rom", "both"):
+                rom[module] = rom.get(module, 0) + size
+            if kind in ("ram", "both"):
+                ram[module] = ram.get(module, 0) + size
+
+    metrics = {}
+    for name, table in (("rom", rom), ("ram", ram)):
+        for module, size in table.items():
+            metrics[f"{name}.{module}"] = size
+        metrics[f"{name}.total"] = sum(table.values())
+    return metrics
+
+
+def check(metrics, thresholds):
+    failures = []
+    for pattern, limit in thresholds.items():
+        if pattern.startswith("_"):
+            continue
+        matched = [k for k in metrics if fnmatch.fnmatchcase(k, pattern)]
+        if not matched:
+            print(f"warning: no metric matches threshold '{pattern}'")
+        for key in matched:
+            value = metrics[key]
+            if "max" in limit and value > limit["max"]:
+                failures.append(f"{key} = {value} > max {limit['max']}")
+            if "min" in limit and value < limit["min"]:
+                failures.append(f"{key} = {value} < min {limit['min']}")
+    return failures
+
+
+def update(thresholds, metrics, headroom):
+    # Exact keys only: patterns are policy, not measurements
+    for key, limit in thresholds.items():
+        if key in metrics and "max" in limit:
+            limit["max"] = int(math.ceil(metrics[key] * (1 + headroom)))
+    return thresholds
+
+
+def print_comparison(metrics, baseline_file, width):
+    with open(baseline_file) as f:
+        baseline = json.load(f)["metrics"]
+
+    print(f"{'metric':<{width}}  {'baseline':>12}  {'this run':>12}  {'delta':>8}")
+    for key in sorted(set(metrics) | set(baseline)):
+        old, new = baseline.get(key), metrics.get(key)
+        if old is None or new is None:
+            delta = ""
+        elif old:
+            delta = f"{100 * (new - old) / old:+.1f}%"
+        else:
+            delta = "n/a" if new else "+0.0%"
+        print(f"{key:<{width}}  {'-' if old is None else old:>12}  "
+              f"{'-' if new is None else new:>12}  {delta:>8}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Firmware benchmark report and regression check.")
+    parser.add_argument("build", help="Build directory of tests/benchmark")
+    parser.add_argument("--log", help="Console output of the run (default: <build>/bench.log)")
+    parser.add_argument("--map", help="Linker map (default: <build>/zephyr/zephyr.map)")
+    parser.add_argument("--thresholds", help="JSON file with per-metric limits")
+    parser.add_argument("--out", help="JSON report (default: <build>/bench.json)")
+    parser.add_argument("--update", action="store_true",
+                        help="Rewrite the 'max' of exact threshold keys from this run")
+    parser.add_argument("--headroom", type=float, default=0.2,
+                        help="Margin added by --update (default: 0.2 = 20%%)")
+    parser.add_argument("--baseline", help="bench.json of another run to compare against")
+    args = parser.parse_args()
+
+    log = args.log or os.path.join(args.build, "bench.log")
+    map_file = args.map or os.path.join(args.build, "zephyr", "zephyr.map")
+    out = args.out or os.path.join(args.build, "bench.json")
+
+    metrics, passed = parse_log(log)
+    if os.path.isfile(map_file):
+        metrics.update(parse_map(map_file))
+    else:
+        print(f"warning: {map_file} not found, ROM/RAM per module skipped")
+
+    thresholds = {}
+    if args.thresholds:
+        with open(args.thresholds) as f:
+            thresholds = json.load(f)
+
+    failures = [] if args.update else check(metrics, thresholds)
+    if passed is not True:
+        failures.insert(0, "test suite did not complete successfully")
+
+    with open(out, "w") as f:
+        json.dump({"passed": not failures, "metrics": metrics, "failures": failures},
+                  f, indent=2, sort_keys=True)
+
+    width = max((len(k) for k in metrics), default=0)
+    if args.baseline:
+        print_comparison(metrics, args.baseline, width)
+    else:
+        for key in sorted(metrics):
+            print(f"{key:<{width}}  {metrics[key]}")
+    print(f"Report written to {out}")
+
+    if args.update and args.thresholds:
+        with open(args.thresholds, "w") as f:
+            json.dump(update(thresholds, metrics, args.headroom), f, indent=2)
+            f.write("\n")
+        print(f"Thresholds updated in {args.thresholds}")
+
+    if failures:
+        print("\nREGRESSIONS:")
+        for failure in failures:
+            print(f"  {failure}")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Decode dictionary-based logs captured from the firmware console.
+
+With log_dict.conf the firmware emits only string IDs and raw arguments,
+hex-encoded on the UART. This wrapper extracts the hex stream from a
+console capture (other text, e.g. printk or shell output, is skipped) and
+formats it with Zephyr's dictionary parser and the build's
+log_dictionary.json database.
+
+    build/zephyr/zephyr.exe | tee build/log_dict.txt
+    python3 utils/log_decode.py build/log_dict.txt
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# Dictionary messages are long unbroken hex runs; shorter runs are text
+HEX_RUN = re.compile(r"[0-9a-fA-F]{16,}")
+
+
+def extract_hex(text):
+    data = bytearray()
+    for run in HEX_RUN.findall(text):
+        if len(run) % 2:
+            run = run[:-1]
+        data += bytes.fromhex(run)
+    return bytes(data)
+
+
+def load_parser(zephyr_base, db_file):
+    sys.path.insert(0, os.path.join(zephyr_base, "scripts", "logging", "dictionary"))
+    try:
+        import dictionary_parser
+        from dictionary_parser.log_database import LogDatabase
+    except ImportError as e:
+        sys.exit(f"Cannot import Zephyr's dictionary parser from {zephyr_base}: {e}")
+
+    database = LogDatabase.read_json_database(db_file)
+    if database is None:
+        sys.exit(f"Cannot read log database {db_file}")
+    return dictionary_parser.get_parser(database)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode dictionary-based Zephyr logs.")
+    parser.add_argument("capture", nargs="?", default="-",
+                        help="Console capture file (default: stdin)")
+    parser.add_argument("--db", default="build/zephyr/log_dictionary.json",
+                        help="Log database generated by the build")
+    parser.add_argument("--zephyr-base", default=os.environ.get("ZEPHYR_BASE", ""),
+                        help="Zephyr tree (default: $ZEPHYR_BASE)")
+    parser.add_argument("--debug", action="store_true", help="Print parser debug output")
+    args = parser.parse_args()
+
+    if not args.zephyr_base:
+        sys.exit("ZEPHYR_BASE not set, use --zephyr-base")
+    if not os.path.isfile(args.db):
+        sys.exit(f"{args.db} not found: build with log_dict.conf first")
+
+    if args.capture == "-":
+        text = sys.stdin.read()
+    else:
+        with open(args.capture, errors="replace") as f:
+            text = f.read()
+
+    data = extract_hex(text)
+    if not data:
+        sys.exit("No dictionary log data found in the capture")
+
+    log_parser = load_parser(args.zephyr_base, args.db)
+    log_parser.parse_log_data(data, debug=args.debug)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,465 @@
+#!/usr/bin/env python3
+"""Shared LoRa channel model for the emulated SX1262 nodes.
+
+Two modes:
+
+  broker  Listen on UDP (default 127.0.0.1:17000) for uplinks forwarded by
+          every native_sim node built with CONFIG_SX1262_EMUL_CHANNEL_BROKER.
+          Each uplink occupies the channel for its time-on-air; when it ends,
+          the broker checks it against every overlapping transmission on the
+          same frequency and answers the node with a delivered/lost verdict.
+          The node's emulated gateway only ACKs delivered uplinks.
+
+  sweep   Offline Monte Carlo with the same collision model: N nodes spread
+          around G gateways, Poisson uplinks, delivery ratio vs node count.
+
+Collision model: a packet is received when its SNR is above the SF
+demodulation floor and, for every interfering SF, the signal-to-interference
+ratio is above the threshold of the SF isolation matrix (Goursaud et al.,
+2015). The diagonal (6 dB) is the co-SF capture effect: the stronger packet
+survives a same-SF collision if it is at least 6 dB above the others.
+"""
+
+import argparse
+import heapq
+import json
+import math
+import queue
+import random
+import select
+import socket
+import struct
+import sys
+import threading
+import time
+import urllib.request
+
+# Protocol shared with sx1262_emul.c (little-endian, packed)
+HDR_MAGIC = 0x42435853      # "SXCB"
+VERDICT_MAGIC = 0x56435853  # "SXCV"
+HDR_FMT = "<IHBBIIIhh"
+VERDICT_FMT = "<IHBB"
+HDR_LEN = struct.calcsize(HDR_FMT)
+
+# Health frame of the node telemetry (src/telemetry.h), version 1
+HEALTH_TYPE = 0xFE
+HEALTH_FMT = "<BBI4B4B2BHH"
+HEALTH_THREADS = ("led", "temp", "light", "lora")
+
+# Authenticated batch frame (src/frame_auth.h): the tag is checked by the
+# backend (POST /frames), the broker only reads the header
+FRAME_TYPE = 0xFD
+FRAME_HDR_FMT = "<BBIIB"
+FRAME_RECORD_LEN = 12
+FRAME_TAG_LEN = 4
+
+OK, WEAK, COLLISION = 0, 1, 2
+REASONS = {OK: "delivered", WEAK: "below sensitivity", COLLISION: "collision"}
+
+# Minimum demodulation SNR for SF5..SF12 (dB, SX1261/2 datasheet)
+REQUIRED_SNR = {5: -2.5, 6: -5.0, 7: -7.5, 8: -10.0, 9: -12.5, 10: -15.0, 11: -17.5, 12: -20.0}
+
+# SIR thresholds (dB): row = wanted SF, column = interfering SF (SF7..SF12)
+SIR_MATRIX = [
+    [6, -8, -9, -9, -9, -9],
+    [-11, 6, -11, -12, -13, -13],
+    [-15, -13, 6, -13, -14, -15],
+    [-19, -18, -17, 6, -17, -18],
+    [-22, -22, -21, -20, 6, -20],
+    [-25, -25, -25, -24, -23, 6],
+]
+
+NOISE_FIGURE_DB = 6
+
+
+def sir_threshold(wanted_sf, interferer_sf):
+    # SF5/SF6 are not in the published matrix: treat them as SF7
+    row = min(max(wanted_sf, 7), 12) - 7
+    col = min(max(interferer_sf, 7), 12) - 7
+    return SIR_MATRIX[row][col]
+
+
+def decode_health(payload):
+    """Health frame as a readable string, None for other payloads."""
+    if len(payload) != struct.calcsize(HEALTH_FMT) or payload[0] != HEALTH_TYPE:
+        return None
+    v = struct.unpack(HEALTH_FMT, payload)
+    log2_us = lambda b: "-" if b == 0xFF else f"<{2 << b}us"
+    cpu = " ".join(f"{n}={c / 2:.1f}%" for n, c in zip(HEALTH_THREADS, v[3:7]))
+    late = " ".join(f"{n}{log2_us(b)}" for n, b in zip(HEALTH_THREADS, v[7:11]))
+    return (f"health v{v[1]} up {v[2]} s | cpu {cpu} | late p99 {late} | "
+            f"fetch p99 sht3xd{log2_us(v[11])} bh1750{log2_us(v[12])} | "
+            f"radio TX {v[13] / 10:.1f} s RX {v[14] / 10:.1f} s")
+
+
+def decode_frame(payload):
+    """Header of an authenticated frame as a readable string, None for other payloads."""
+    hdr_len = struct.calcsize(FRAME_HDR_FMT)
+    if len(payload) < hdr_len or payload[0] != FRAME_TYPE:
+        return None
+    _, version, device, counter, count = struct.unpack_from(FRAME_HDR_FMT, payload)
+    if len(payload) != hdr_len + count * FRAME_RECORD_LEN + FRAME_TAG_LEN:
+        return None
+    return f"frame v{version} device {device} counter {counter} | {count} readings"
+
+
+def describe(payload):
+    return decode_health(payload) or decode_frame(payload)
+
+
+class Forwarder:
+    """POST delivered authenticated frames to the backend, as a gateway would.
+
+    The HTTP round trip runs on its own thread: the channel loop only queues
+    the frame, so uplinks arriving meanwhile still get their real start time.
+    Frames queued during a POST go out together in the next one, concatenated
+    as /frames accepts them.
+    """
+
+    def __init__(self, url, max_frames):
+        self.url = url
+        self.max_frames = max_frames
+        self.frames = queue.Queue()
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def put(self, label, payload):
+        self.frames.put((label, payload))
+
+    def close(self):
+        self.frames.put(None)
+        self.thread.join(timeout=5)
+
+    def run(self):
+        while True:
+            batch = [self.frames.get()]
+            while batch[-1] is not None and len(batch) < self.max_frames:
+                try:
+                    batch.append(self.frames.get_nowait())
+                except queue.Empty:
+                    break
+            done = batch[-1] is None
+            batch = [b for b in batch if b is not None]
+            if batch:
+                result = self.post(b"".join(payload for _, payload in batch))
+                labels = ", ".join(label for label, _ in batch)
+                print(f"{labels} forwarded: {result}", flush=True)
+            if done:
+                return
+
+    def post(self, body):
+        req = urllib.request.Request(self.url, data=body, headers={"Content-Type": "application/octet-stream"})
+        try:
+            with urllib.request.urlopen(req, timeout=2) as resp:
+                return json.load(resp)
+        except (OSError, ValueError) as e:
+            return {"error": str(e)}
+
+
+def noise_floor_dbm(bw_hz):
+    return -174 + 10 * math.log10(bw_hz) + NOISE_FIGURE_DB
+
+
+def time_on_air_us(sf, bw_hz, payload_len, cr=1, preamble=8, crc=True, implicit=False):
+    """Same formula as SX126xGetTimeOnAir (loramac-node) and the emulator."""
+    ldro = (sf >= 11 and bw_hz <= 125000) or (sf == 12 and bw_hz == 250000)
+    num = 8 * payload_len + (16 if crc else 0) - 4 * sf + (0 if implicit else 20)
+    if sf <= 6:
+        den = 4 * sf
+    else:
+        num += 8
+        den = 4 * (sf - 2) if ldro else 4 * sf
+    num = max(num, 0)
+    symbols = -(-num // den) * (cr + 4) + preamble + 12
+    if sf <= 6:
+        symbols += 2
+    return (4 * symbols + 1) * (1 << (sf - 2)) * 1000000 // bw_hz
+
+
+class Tx:
+    __slots__ = ("node", "seq", "start", "end", "freq", "sf", "bw", "rssi", "snr")
+
+    def __init__(self, node, seq, start, end, freq, sf, bw, rssi, snr):
+        self.node = node
+        self.seq = seq
+        self.start = start
+        self.end = end
+        self.freq = freq
+        self.sf = sf
+        self.bw = bw
+        self.rssi = rssi
+        self.snr = snr
+
+
+def evaluate(tx, others):
+    """Verdict for tx given the transmissions heard by the same gateway."""
+    if tx.snr < REQUIRED_SNR.get(tx.sf, 0):
+        return WEAK
+
+    # Interference power per SF, summed in mW
+    interference = {}
+    for other in others:
+        if other is tx or other.freq != tx.freq:
+            continue
+        if other.end <= tx.start or other.start >= tx.end:
+            continue
+        interference[other.sf] = interference.get(other.sf, 0.0) + 10 ** (other.rssi / 10)
+
+    for sf, power_mw in interference.items():
+        if tx.rssi - 10 * math.log10(power_mw) < sir_threshold(tx.sf, sf):
+            return COLLISION
+    return OK
+
+
+class Stats:
+    def __init__(self):
+        self.nodes = {}
+
+    def add(self, node, verdict):
+        counts = self.nodes.setdefault(node, [0, 0, 0])
+        counts[verdict] += 1
+
+    def totals(self):
+        total = [0, 0, 0]
+        for counts in self.nodes.values():
+            for i, n in enumerate(counts):
+                total[i] += n
+        return total
+
+    def report(self, out=sys.stdout):
+        total = self.totals()
+        sent = sum(total)
+        if not sent:
+            print("No uplinks yet", file=out)
+            return
+        print(f"{len(self.nodes)} nodes, {sent} uplinks: "
+              f"delivered {100 * total[OK] / sent:.1f}%, "
+              f"collisions {100 * total[COLLISION] / sent:.1f}%, "
+              f"below sensitivity {100 * total[WEAK] / sent:.1f}%", file=out)
+        for node, counts in sorted(self.nodes.items()):
+            n = sum(counts)
+            print(f"  {node:<22} {n:6d} sent  {100 * counts[OK] / n:5.1f}% delivered", file=out)
+
+
+# ---------------------------------------------------------------------------
+# broker
+# ---------------------------------------------------------------------------
+
+def run_broker(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.addr, args.port))
+    print(f"LoRa channel broker on {args.addr}:{args.port}")
+
+    active = []     # transmissions that may still overlap a pending one
+    pending = []    # heap of (end, id, tx, addr)
+    stats = Stats()
+    forwarder = Forwarder(args.forward, args.forward_batch) if args.forward else None
+    next_report = time.monotonic() + args.report
+
+    try:
+        while True:
+            now = time.monotonic()
+            timeout = min(next_report, pending[0][0] if pending else next_report) - now
+            ready, _, _ = select.select([sock], [], [], max(timeout, 0))
+
+            if ready:
+                data, addr = sock.recvfrom(2048)
+                now = time.monotonic()
+                if len(data) < HDR_LEN or struct.unpack_from("<I", data)[0] != HDR_MAGIC:
+                    # Nodes without CONFIG_SX1262_EMUL_CHANNEL_BROKER: raw payload
+                    print(f"{addr[0]}:{addr[1]} raw {describe(data) or data.hex()}")
+                    continue
+                magic, seq, sf, cr, freq, bw, toa_us, rssi, snr = struct.unpack_from(HDR_FMT, data)
+                node = f"{addr[0]}:{addr[1]}"
+                tx = Tx(node, seq, now, now + toa_us / 1e6, freq, sf, bw, rssi / 10, snr / 10)
+                payload = data[HDR_LEN:]
+                info = describe(payload)
+                if info:
+                    print(f"{node} #{seq} {info}")
+                active.append(tx)
+                heapq.heappush(pending, (tx.end, id(tx), tx, addr, payload))
+
+            now = time.monotonic()
+            while pending and pending[0][0] <= now:
+                _, _, tx, addr, payload = heapq.heappop(pending)
+                verdict = evaluate(tx, active)
+                stats.add(tx.node, verdict)
+                sock.sendto(struct.pack(VERDICT_FMT, VERDICT_MAGIC, tx.seq,
+                                        verdict == OK, verdict), addr)
+                if args.verbose:
+                    print(f"{tx.node} #{tx.seq} SF{tx.sf} {tx.freq} Hz "
+                          f"RSSI {tx.rssi:.1f} dBm: {REASONS[verdict]}")
+                if forwarder and verdict == OK and decode_frame(payload):
+                    forwarder.put(f"{tx.node} #{tx.seq}", payload)
+
+            # Keep only what can still overlap a transmission in flight
+            horizon = min((p[2].start for p in pending), default=now)
+            active = [t for t in active if t.end > horizon]
+
+            if now >= next_report:
+                stats.report()
+                next_report = now + args.report
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if forwarder:
+            forwarder.close()
+        stats.report()
+        sock.close()
+
+
+# ---------------------------------------------------------------------------
+# sweep
+# ---------------------------------------------------------------------------
+
+def path_loss_db(distance_m, args):
+    # Log-distance model, defaults from Bor et al. (LoRaSim)
+    return args.pl0 + 10 * args.gamma * math.log10(max(distance_m, 1.0) / args.d0)
+
+
+def random_point(radius, rng):
+    r = radius * math.sqrt(rng.random())
+    a = 2 * math.pi * rng.random()
+    return r * math.cos(a), r * math.sin(a)
+
+
+def pick_sf(mean_snr, args):
+    if args.sf != "adr":
+        return int(args.sf)
+    # Same rule as the on-node ADR: lowest SF that keeps the margin
+    for sf in range(7, 13):
+        if mean_snr - REQUIRED_SNR[sf] >= args.margin:
+            return sf
+    return 12
+
+
+def simulate(n_nodes, args, rng):
+    noise = noise_floor_dbm(args.bw)
+    gateways = [(0.0, 0.0)] + [random_point(args.radius, rng) for _ in range(args.gateways - 1)]
+    channels = [868100000 + 200000 * i for i in range(args.channels)]
+
+    # Static per-link attenuation (distance + shadowing)
+    nodes = []
+    for n in range(n_nodes):
+        x, y = random_point(args.radius, rng)
+        loss = [path_loss_db(math.hypot(x - gx, y - gy), args) + rng.gauss(0, args.shadowing)
+                for gx, gy in gateways]
+        sf = pick_sf(args.tx_power - min(loss) - noise, args)
+        nodes.append((n, sf, loss))
+
+    # Poisson uplinks: one Tx per gateway, sharing start/end/frequency
+    uplinks = []
+    airtime = 0.0
+    for n, sf, loss in nodes:
+        toa = time_on_air_us(sf, args.bw, args.payload) / 1e6
+        t = rng.expovariate(1 / args.interval)
+        seq = 0
+        while t < args.duration:
+            freq = rng.choice(channels)
+            per_gw = []
+            for g, pl in enumerate(loss):
+                rssi = args.tx_power - pl + rng.gauss(0, args.fading)
+                per_gw.append(Tx(n, seq, t, t + toa, freq, sf, args.bw, rssi, rssi - noise))
+            uplinks.append(per_gw)
+            airtime += toa
+            seq += 1
+            t += rng.expovariate(1 / args.interval)
+
+    uplinks.sort(key=lambda u: u[0].start)
+
+    # Sweep line per gateway: only transmissions still on air can interfere
+    verdicts = [WEAK] * len(uplinks)
+    max_toa = max((u[0].end - u[0].start for u in uplinks), default=0)
+    for g in range(len(gateways)):
+        heard = [u[g] for u in uplinks]
+        lo = 0
+        for i, tx in enumerate(heard):
+            while heard[lo].start + max_toa <= tx.start:
+                lo += 1
+            hi = i
+            while hi < len(heard) and heard[hi].start < tx.end:
+                hi += 1
+            verdict = evaluate(tx, heard[lo:hi])
+            # Delivered if at least one gateway decodes it
+            if verdict == OK or (verdict == COLLISION and verdicts[i] == WEAK):
+                verdicts[i] = verdict
+
+    load = airtime / (args.duration * len(channels))
+    return {
+        "nodes": n_nodes,
+        "uplinks": len(uplinks),
+        "load": load,
+        "delivered": verdicts.count(OK) / max(len(uplinks), 1),
+        "collision": verdicts.count(COLLISION) / max(len(uplinks), 1),
+        "weak": verdicts.count(WEAK) / max(len(uplinks), 1),
+        "aloha": math.exp(-2 * load),
+        "sf": {sf: sum(1 for n in nodes if n[1] == sf) for sf in range(7, 13)},
+    }
+
+
+def run_sweep(args):
+    rng = random.Random(args.seed)
+    results = []
+
+    print(f"{'nodes':>6} {'uplinks':>8} {'load G':>7} {'deliv%':>7} "
+          f"{'coll%':>6} {'weak%':>6} {'ALOHA%':>7}")
+    for n in [int(v) for v in args.nodes.split(",")]:
+        runs = [simulate(n, args, rng) for _ in range(args.runs)]
+        avg = {k: sum(r[k] for r in runs) / len(runs)
+               for k in ("uplinks", "load", "delivered", "collision", "weak", "aloha")}
+        avg["nodes"] = n
+        avg["sf"] = runs[-1]["sf"]
+        results.append(avg)
+        print(f"{n:6d} {avg['uplinks']:8.0f} {avg['load']:7.3f} {100 * avg['delivered']:7.1f} "
+              f"{100 * avg['collision']:6.1f} {100 * avg['weak']:6.1f} {100 * avg['aloha']:7.1f}")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"params": vars(args), "results": results}, f, indent=2)
+        print(f"Results written to {args.json}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Shared LoRa channel model for emulated SX1262 nodes.")
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    broker = sub.add_parser("broker", help="Decide collisions between running native_sim nodes")
+    broker.add_argument("--addr", default="127.0.0.1", help="Listen address")
+    broker.add_argument("--port", type=int, default=17000, help="Listen port (CONFIG_SX1262_EMUL_UDP_PORT)")
+    broker.add_argument("--report", type=float, default=60.0, help="Seconds between delivery reports")
+    broker.add_argument("-v", "--verbose", action="store_true", help="Print every verdict")
+    broker.add_argument("--forward", metavar="URL",
+                        help="POST delivered authenticated frames here (e.g. http://localhost:8000/frames)")
+    broker.add_argument("--forward-batch", type=int, default=32,
+                        help="Max frames per POST when uplinks pile up during a request")
+
+    sweep = sub.add_parser("sweep", help="Monte Carlo delivery ratio vs node count")
+    sweep.add_argument("--nodes", default="10,50,100,200,500,1000", help="Comma-separated node counts")
+    sweep.add_argument("--gateways", type=int, default=1, help="Gateways in the area")
+    sweep.add_argument("--channels", type=int, default=3, help="Uplink frequencies (EU868 default: 3)")
+    sweep.add_argument("--interval", type=float, default=300.0, help="Mean uplink interval per node (s)")
+    sweep.add_argument("--duration", type=float, default=3600.0, help="Simulated time per run (s)")
+    sweep.add_argument("--runs", type=int, default=3, help="Runs averaged per node count")
+    sweep.add_argument("--payload", type=int, default=16, help="Payload length (bytes)")
+    sweep.add_argument("--sf", default="adr", help="Fixed SF (7..12) or 'adr'")
+    sweep.add_argument("--margin", type=float, default=10.0, help="ADR margin (dB)")
+    sweep.add_argument("--bw", type=int, default=125000, help="Bandwidth (Hz)")
+    sweep.add_argument("--tx-power", type=float, default=14.0, help="Node TX power (dBm)")
+    sweep.add_argument("--radius", type=float, default=500.0, help="Area radius (m)")
+    sweep.add_argument("--pl0", type=float, default=127.41, help="Path loss at d0 (dB)")
+    sweep.add_argument("--d0", type=float, default=40.0, help="Reference distance (m)")
+    sweep.add_argument("--gamma", type=float, default=2.08, help="Path loss exponent")
+    sweep.add_argument("--shadowing", type=float, default=3.57, help="Per-link shadowing sigma (dB)")
+    sweep.add_argument("--fading", type=float, default=3.0, help="Per-packet fading sigma (dB)")
+    sweep.add_argument("--seed", type=int, default=1, help="Random seed")
+    sweep.add_argument("--json", help="Write results to this file")
+
+    args = parser.parse_args()
+    if args.mode == "broker":
+        run_broker(args)
+    else:
+        run_sweep(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Static RAM budget of a firmware build.
+
+Groups every RAM symbol of zephyr.elf (data, bss, noinit) into categories:
+thread stacks, thread control blocks, logging buffers, driver data,
+emulator state, heaps. Prints the totals with the largest symbols of each
+category and the headroom left on the target. The configured sizes
+(*_STACK_SIZE, LOG_BUFFER_SIZE, ...) come from zephyr/.config.
+
+Exits with status 1 if --budget is given and static RAM exceeds it.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+# First matching category wins
+CATEGORIES = [
+    ("stacks", r"(_stack|_stacks|_stack_area)$|^z_(main|idle|interrupt)_stacks?"),
+    ("threads", r"_thread_data$|^z_main_thread$|^z_idle_threads$|_thread$"),
+    ("logging", r"^buf32$|^log_|_log_|^mpsc_pbuf"),
+    ("emulators", r"_emul_data|_emul_\d|^emul_"),
+    ("heap", r"heap|^z_malloc"),
+    ("drivers", r"_data_?\d+$|_dev_data|^__devstate|__device_dts_ord|_config_\d+$"),
+]
+
+RAM_TYPES = set("bBdDsSvV")
+
+# Internal SRAM usable by the application (KB)
+TARGET_RAM_KB = {
+    "esp32s3": 512,
+    "esp32c3": 400,
+    "esp32": 520,
+}
+
+CONFIG_KEYS = re.compile(r"^CONFIG_(\w*(STACK_SIZE|LOG_BUFFER_SIZE|HEAP_MEM_POOL_SIZE|EMUL_DOWNLINK_MAX))=(\d+)")
+
+
+def find_nm(build):
+    cache = os.path.join(build, "CMakeCache.txt")
+    if os.path.isfile(cache):
+        with open(cache) as f:
+            for line in f:
+                if line.startswith("CMAKE_NM:"):
+                    return line.split("=", 1)[1].strip()
+    return "nm"
+
+
+def read_config(build):
+    config, board = {}, ""
+    path = os.path.join(build, "zephyr", ".config")
+    if not os.path.isfile(path):
+        return config, board
+    with open(path) as f:
+        for line in f:
+            m = CONFIG_KEYS.match(line)
+            if m:
+                config[m.group(1)] = int(m.group(3))
+            elif line.startswith("CONFIG_BOARD="):
+                board = line.split("=", 1)[1].strip().strip('"')
+    return config, board
+
+
+def ram_symbols(nm, elf):
+    out = subprocess.run([nm, "--print-size", "--size-sort", elf],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 4 and parts[2] in RAM_TYPES:
+            symbols.append((parts[3], int(parts[1], 16)))
+    return symbols
+
+
+def categorize(symbols):
+    categories = {name: [] for name, _ in CATEGORIES}
+    categories["other"] = []
+    for name, size in symbols:
+        for category, pattern in CATEGORIES:
+            if re.search(pattern, name):
+                categories[category].append((name, size))
+                break
+        else:
+            categories["other"].append((name, size))
+    return categories
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Static RAM budget of a Zephyr build.")
+    parser.add_argument("build", nargs="?", default="build", help="Build directory (default: build)")
+    parser.add_argument("--elf", help="ELF file (default: <build>/zephyr/zephyr.elf)")
+    parser.add_argument("--nm", help="nm binary (default: CMAKE_NM from CMakeCache.txt)")
+    parser.add_argument("--target", choices=sorted(TARGET_RAM_KB),
+                        help="Target SoC for the headroom (default: from CONFIG_BOARD)")
+    parser.add_argument("--budget", type=int, help="Max static RAM in bytes")
+    parser.add_argument("--top", type=int, default=5, help="Largest symbols listed per category")
+    parser.add_argument("--json", help="Write the report to this file")
+    args = parser.parse_args()
+
+    elf = args.elf or os.path.join(args.build, "zephyr", "zephyr.elf")
+    config, board = read_config(args.build)
+    categories = categorize(ram_symbols(args.nm or find_nm(args.build), elf))
+    total = sum(size for syms in categories.values() for _, size in syms)
+
+    target = args.target or next((soc for soc in sorted(TARGET_RAM_KB, key=len, reverse=True)
+                                  if soc in board), None)
+
+    print(f"Static RAM of {elf}" + (f" ({board})" if board else ""))
+    for category, syms in categories.items():
+        size = sum(s for _, s in syms)
+        print(f"\n{category:<10} {size:8d} B  {100 * size / max(total, 1):5.1f}%")
+        for name, s in sorted(syms, key=lambda x: -x[1])[:args.top]:
+            print(f"    {name:<40} {s:8d}")
+    print(f"\n{'total':<10} {total:8d} B")
+
+    if target:
+        ram = TARGET_RAM_KB[target] * 1024
+        print(f"{target} SRAM {ram} B, headroom {ram - total} B ({100 * (ram - total) / ram:.1f}%)")
+
+    if config:
+        print("\nConfigured sizes:")
+        for key in sorted(config):
+            print(f"    CONFIG_{key:<36} {config[key]:8d}")
+
+    if args.json:
+        report = {
+            "elf": elf,
+            "board": board,
+            "total": total,
+            "categories": {c: {"size": sum(s for _, s in syms), "symbols": dict(syms)}
+                           for c, syms in categories.items()},
+            "config": config,
+        }
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+    if args.budget is not None and total > args.budget:
+        print(f"\nStatic RAM {total} B exceeds budget {args.budget} B")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Per-section and per-module image size, with deltas against a baseline.
+
+Reads the allocated sections straight from zephyr.elf (no cross binutils
+needed, works for native_sim and Xtensa builds alike) and ROM/RAM per
+module from zephyr.map. The baseline is either another build directory or
+a JSON file saved earlier with --save:
+
+    python3 utils/size_delta.py build --save build/size_baseline.json
+    ... change something, rebuild ...
+    python3 utils/size_delta.py build --baseline build/size_baseline.json
+    python3 utils/size_delta.py build_prod --baseline build_prod_os
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+from bench_report import parse_map
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+
+def elf_sections(path):
+    """Size of every allocated section of an ELF file."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF":
+        sys.exit(f"{path} is not an ELF file")
+
+    is64 = data[4] == 2
+    endian = "<" if data[5] == 1 else ">"
+    if is64:
+        shoff, = struct.unpack_from(endian + "Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x3A)
+        header = endian + "IIQQQQIIQQ"
+    else:
+        shoff, = struct.unpack_from(endian + "I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x2E)
+        header = endian + "IIIIIIIIII"
+
+    headers = [struct.unpack_from(header, data, shoff + i * shentsize) for i in range(shnum)]
+    strtab = headers[shstrndx][4]
+
+    sections = {}
+    for name_off, sh_type, flags, _, _, size, *_ in headers:
+        if not flags & SHF_ALLOC or not size:
+            continue
+        end = data.index(b"\0", strtab + name_off)
+        name = data[strtab + name_off:end].decode()
+        sections[name] = sections.get(name, 0) + size
+    return sections
+
+
+def load(source):
+    """Sizes of a build directory or of a JSON saved with --save."""
+    if os.path.isfile(source):
+        with open(source) as f:
+            return json.load(f)
+
+    elf = os.path.join(source, "zephyr", "zephyr.elf")
+    map_file = os.path.join(source, "zephyr", "zephyr.map")
+    if not os.path.isfile(elf):
+        sys.exit(f"{elf} not found")
+    return {
+        "sections": elf_sections(elf),
+        "modules": parse_map(map_file) if os.path.isfile(map_file) else {},
+    }
+
+
+def print_table(title, current, baseline):
+    keys = sorted(set(current) | set(baseline or {}), key=lambda k: (-current.get(k, 0), k))
+    if not keys:
+        return
+    width = max(len(k) for k in keys)
+    print(f"\n{title:<{width}}  {'size':>9}" + (f"  {'baseline':>9}  {'delta':>8}" if baseline is not None else ""))
+    for key in keys:
+        new = current.get(key, 0)
+        line = f"{key:<{width}}  {new:9d}"
+        if baseline is not None:
+            old = baseline.get(key, 0)
+            line += f"  {old:9d}  {new - old:+8d}"
+        print(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Image size per section and module, with deltas.")
+    parser.add_argument("build", nargs="?", default="build", help="Build directory (default: build)")
+    parser.add_argument("--baseline", help="Build directory or JSON saved with --save")
+    parser.add_argument("--save", help="Write this build's sizes to a JSON file")
+    parser.add_argument("--max-growth", type=int,
+                        help="Exit with status 1 if rom.total grows more than this (bytes)")
+    args = parser.parse_args()
+
+    current = load(args.build)
+    baseline = load(args.baseline) if args.baseline else None
+
+    print_table("section", current["sections"], baseline and baseline["sections"])
+    print_table("module", current["modules"], baseline and baseline["modules"])
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(current, f, indent=2, sort_keys=True)
+        print(f"\nSizes saved to {args.save}")
+
+    if args.max_growth is not None and baseline:
+        growth = current["modules"].get("rom.total", 0) - baseline["modules"].get("rom.total", 0)
+        if growth > args.max_growth:
+            print(f"\nROM grew by {growth} B (max {args.max_growth} B)")
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()